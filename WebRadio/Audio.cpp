@@ -19,6 +19,12 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Audio.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "Utils.hpp"
@@ -27,17 +33,28 @@ namespace Audio {
 
 namespace {
 
-static const std::size_t packetChannelSize = 2;
+// lets demux run ahead of decode, power of 2
+static const std::size_t packetChannelSize = 64;
+static const std::size_t avioBufferSize = 32 * 1024;
 static const std::size_t SDLSampleSize = 1024;
+// smallest decode-ahead, in callbacks
+static const std::size_t ringCallbacks = 8;
+// producer wait when the ring is full, well below one callback period
+static const std::chrono::milliseconds ringFullWait(5);
+// SDL events and end of playback checks
+static const std::chrono::milliseconds pollPeriod(10);
+static const std::chrono::seconds reportPeriod(5);
 static const ::AVSampleFormat FrameFormat = AV_SAMPLE_FMT_FLT;
 static const int SDLSampleFormat = AUDIO_F32SYS;
+static const std::chrono::milliseconds defaultDecodeAhead(500);
 
 template <typename V>
 void emptyFunction(V *) {}
 
-// not thread safe, we use fibers
+// acquired by the demux thread, released by the decode thread
 template <typename T, void (*FreeFunction)(T *) = emptyFunction<T>>
 class ObjectPool {
+  std::mutex _mutex;
   std::vector<T *> _free;
   std::vector<T *> _used;
   T *_ready;
@@ -46,7 +63,12 @@ class ObjectPool {
 
  public:
   ObjectPool(std::size_t size = 4096)
-      : _free(), _used(), _ready(new T[size]), _size(size), _pos(0) {
+      : _mutex(),
+        _free(),
+        _used(),
+        _ready(new T[size]()),
+        _size(size),
+        _pos(0) {
     _free.reserve(size / 2);
   }
 
@@ -65,6 +87,7 @@ class ObjectPool {
   ObjectPool(ObjectPool &&) = delete;
 
   T *acquire() {
+    std::lock_guard<std::mutex> lock(_mutex);
     T *packet = nullptr;
     if (!_free.empty()) {
       packet = _free.back();
@@ -72,7 +95,7 @@ class ObjectPool {
     } else if (_pos < _size) {
       packet = &_ready[_pos++];
     } else {
-      packet = new T;
+      packet = new T();
       _used.push_back(packet);
       LOG << _used.size()
           << " object created, consider allocating more to pool than " << _size;
@@ -82,60 +105,163 @@ class ObjectPool {
 
   void release(T *packet) {
     FreeFunction(packet);
+    std::lock_guard<std::mutex> lock(_mutex);
     _free.push_back(packet);
   }
 };
 
-ObjectPool<::AVPacket> &getPool() {
-  // static ObjectPool<::AVPacket, &::av_free_packet> pool;
-  static ObjectPool<::AVPacket> pool;
+ObjectPool<::AVPacket, &::av_packet_unref> &getPool() {
+  static ObjectPool<::AVPacket, &::av_packet_unref> pool;
 
   return pool;
 }
 
-// SDL audio callback
-void audioCallback(void *userData, std::uint8_t *stream, int len) {
-  DataChannel *dataChannel = static_cast<DataChannel *>(userData);
-  static std::vector<float> vecData;
-  vecData.reserve(len);
-
-  boost::fibers::fiber pullData([dataChannel, stream, len]() {
-    float data;
-    while (boost::fibers::channel_op_status::success ==
-               dataChannel->pop(data) &&
-           vecData.size() * sizeof(float) < len) {
-      vecData.push_back(data);
+// waits until the SDL callback made room for all samples, false if
+// playback was stopped meanwhile
+bool pushSamples(SampleRing &sampleRing, const float *samples,
+                 std::size_t count, const FFmpegWrapper &ffmpeg) {
+  for (;;) {
+    const std::size_t written = sampleRing.write(samples, count);
+    samples += written;
+    count -= written;
+    if (count == 0) {
+      return true;
     }
-    std::memcpy(stream, (uint8_t *)vecData.data(), len);
-    vecData.clear();
-  });
+    if (ffmpeg.isStopped()) {
+      return false;
+    }
+    std::this_thread::sleep_for(ringFullWait);
+  }
+}
+
+// frame samples, planar or packed, to interleaved output
+void interleave(const ::AVFrame &frame, int nbChannels,
+                std::vector<float> &output) {
+  output.resize(frame.nb_samples * nbChannels);
+  if (!::av_sample_fmt_is_planar(
+          static_cast<::AVSampleFormat>(frame.format))) {
+    std::memcpy(output.data(), frame.data[0], output.size() * sizeof(float));
+    return;
+  }
+  const float *const *data =
+      reinterpret_cast<const float *const *>(frame.extended_data);
+  float *out = output.data();
+  for (int smp = 0; smp < frame.nb_samples; ++smp) {
+    for (int chn = 0; chn < nbChannels; ++chn) {
+      *out++ = data[chn][smp];
+    }
+  }
+}
 
-  pullData.join();
+std::chrono::milliseconds toDuration(std::size_t nbSamples, int sampleRate,
+                                     int nbChannels) {
+  return std::chrono::milliseconds(nbSamples * 1000 /
+                                   (sampleRate * nbChannels));
+}
+
+// everything the SDL callback touches, set up before the device opens
+struct CallbackContext {
+  SampleRing &_sampleRing;
+  CallbackStats &_stats;
+};
+
+// SDL audio callback, realtime thread : no allocation, no lock, no fiber,
+// at most two memcpy and one fill
+void audioCallback(void *userData, std::uint8_t *stream, int len) {
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+
+  CallbackContext *context = static_cast<CallbackContext *>(userData);
+  float *samples = reinterpret_cast<float *>(stream);
+  const std::size_t count = len / sizeof(float);
+
+  const std::size_t read = context->_sampleRing.read(samples, count);
+  // silence on underrun
+  std::fill(samples + read, samples + count, 0.f);
+
+  context->_stats.record(
+      count, read,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                           start)
+          .count());
 }
 
 }  // namespace
 
-void playAudio(const std::string &response, bool isRepeat) {
+CallbackStats::CallbackStats()
+    : _nbCallbacks(0),
+      _nbUnderruns(0),
+      _nbMissingSamples(0),
+      _hasStarted(false),
+      _duration() {}
+
+void CallbackStats::record(std::size_t nbRequested, std::size_t nbRead,
+                           std::uint64_t durationNs) {
+  _nbCallbacks.fetch_add(1, std::memory_order_relaxed);
+  if (nbRead > 0) {
+    _hasStarted.store(true, std::memory_order_relaxed);
+  }
+  // no samples before the first decoded frame is not an underrun
+  if (nbRead < nbRequested && _hasStarted.load(std::memory_order_relaxed)) {
+    _nbUnderruns.fetch_add(1, std::memory_order_relaxed);
+    _nbMissingSamples.fetch_add(nbRequested - nbRead,
+                                std::memory_order_relaxed);
+  }
+  _duration.record(durationNs);
+}
+
+std::uint64_t CallbackStats::getNbCallbacks() const {
+  return _nbCallbacks.load();
+}
+
+std::uint64_t CallbackStats::getNbUnderruns() const {
+  return _nbUnderruns.load();
+}
+
+std::ostream &operator<<(std::ostream &os, const CallbackStats &stats) {
+  return os << "audio callbacks : " << stats._nbCallbacks.load() << ", "
+            << stats._nbUnderruns.load() << " underruns, "
+            << stats._nbMissingSamples.load() << " samples of silence"
+            << "\n  duration ns " << stats._duration;
+}
+
+CallbackStats &getCallbackStats() {
+  static CallbackStats stats;
+  return stats;
+}
+
+PlayOptions::PlayOptions()
+    : _isRepeat(false), _decodeAhead(defaultDecodeAhead), _nbDecodeThreads(1) {}
+
+void playAudio(const Http::StreamBuffer &response, const PlayOptions &options) {
   LOG << "start playing audio ";
 
   av_register_all();
 
-  FFmpegWrapper ffmpeg(response);
+  FFmpegWrapper ffmpeg(response, options._nbDecodeThreads);
   if (!ffmpeg.isInit()) {
     LOG << "could not initialize ffmpeg";
     return;
   }
 
-  DataChannel dataChannel(SDLSampleSize / sizeof(float));
+  const int sampleRate = ffmpeg.getSampleRate();
+  const int nbChannels = ffmpeg.getNbOfChannels();
+  SampleRing sampleRing(std::max<std::size_t>(
+      SDLSampleSize * nbChannels * ringCallbacks,
+      options._decodeAhead.count() * sampleRate / 1000 * nbChannels));
+  LOG << "decode ahead "
+      << toDuration(sampleRing.getCapacity(), sampleRate, nbChannels).count()
+      << " ms";
+  CallbackContext callbackContext{sampleRing, getCallbackStats()};
   SDL_Init(SDL_INIT_AUDIO);
   SDL_AudioSpec inputSpec, outputSpec;
-  inputSpec.freq = ffmpeg.getSampleRate();
+  inputSpec.freq = sampleRate;
   inputSpec.format = SDLSampleFormat;
-  inputSpec.channels = ffmpeg.getNbOfChannels();
+  inputSpec.channels = nbChannels;
   inputSpec.silence = 0;
   inputSpec.samples = SDLSampleSize;
   inputSpec.callback = audioCallback;
-  inputSpec.userdata = &dataChannel;
+  inputSpec.userdata = &callbackContext;
 
   if (SDL_OpenAudio(&inputSpec, &outputSpec) < 0) {
     LOG << "SDL could not open audio : " << SDL_GetError();
@@ -147,44 +273,128 @@ void playAudio(const std::string &response, bool isRepeat) {
   SDL_PauseAudio(0);
 
   PacketChannel packetChannel(packetChannelSize);
+  std::atomic<bool> isDecoded(false);
 
-  boost::fibers::fiber pushPacket(
+  // demux and decode each get a core, this thread only watches
+  std::thread demuxThread(
       [&ffmpeg, &packetChannel]() { ffmpeg.read(packetChannel); });
 
-  std::vector<float> songData;
-  boost::fibers::fiber pullPacket(
-      [&ffmpeg, &packetChannel, &dataChannel, &songData]() {
-        songData = ffmpeg.bufferData(packetChannel, dataChannel);
-      });
-
-  pushPacket.join();
-  pullPacket.join();
-
-  if (isRepeat && !songData.empty()) {
+  std::thread decodeThread([&ffmpeg, &packetChannel, &sampleRing, &isDecoded,
+                            &options]() {
+    const std::vector<float> songData =
+        ffmpeg.bufferData(packetChannel, sampleRing, options._isRepeat);
     // no need to redo packet decoding
-    boost::fibers::fiber replay([&dataChannel, &songData]() {
-      for (;;) {
-        LOG << "Replay song";
-        for (float f : songData) {
-          dataChannel.push(f);
-        }
+    while (options._isRepeat && !songData.empty() &&
+           pushSamples(sampleRing, songData.data(), songData.size(), ffmpeg)) {
+      LOG << "Replay song";
+    }
+    isDecoded = true;
+  });
+
+  // lowest fill once the ring was half full, startup excluded
+  std::size_t minFill = sampleRing.getCapacity();
+  bool hasFilled = false;
+  std::chrono::steady_clock::time_point nextReport =
+      std::chrono::steady_clock::now() + reportPeriod;
+  SDL_Event event;
+  // until the callback played what is still buffered
+  while (!ffmpeg.isStopped() && !(isDecoded && sampleRing.size() == 0)) {
+    while (SDL_PollEvent(&event)) {
+      if (event.type == SDL_QUIT) {
+        LOG << "SDL_QUIT";
+        ffmpeg.stop();
+        // unblocks demux and decode
+        packetChannel.close();
       }
-    });
-    replay.join();
+    }
+
+    const std::size_t fill = sampleRing.size();
+    hasFilled = hasFilled || fill >= sampleRing.getCapacity() / 2;
+    if (hasFilled && !isDecoded) {
+      minFill = std::min(minFill, fill);
+    }
+    if (std::chrono::steady_clock::now() >= nextReport) {
+      nextReport += reportPeriod;
+      LOG_DEBUG << "buffer fill "
+                << toDuration(fill, sampleRate, nbChannels).count()
+                << " ms, decode speed x" << ffmpeg.getDecodeSpeed();
+    }
+    std::this_thread::sleep_for(pollPeriod);
   }
 
-  dataChannel.close();
+  demuxThread.join();
+  decodeThread.join();
   LOG << "end playing audio";
+  LOG << "decode speed x" << ffmpeg.getDecodeSpeed() << ", buffer fill min "
+      << toDuration(minFill, sampleRate, nbChannels).count() << " ms of "
+      << toDuration(sampleRing.getCapacity(), sampleRate, nbChannels).count()
+      << " ms";
+  LOG << getCallbackStats();
 
   SDL_CloseAudio();
   SDL_Quit();
 }
 
-CustomAvioContext::CustomAvioContext(std::string input)
-    : _data(std::move(input)),
+void benchmarkDecode(const Http::StreamBuffer &data, int nbDecodeThreads,
+                     std::ostream &os) {
+  typedef std::chrono::steady_clock Clock;
+  av_register_all();
+
+  std::vector<int> threadCounts{1};
+  if (nbDecodeThreads != 1) {
+    threadCounts.push_back(nbDecodeThreads);
+  }
+  for (int threadCount : threadCounts) {
+    FFmpegWrapper ffmpeg(data, threadCount);
+    if (!ffmpeg.isInit()) {
+      os << "could not initialize ffmpeg\n";
+      return;
+    }
+
+    // same threads as playback, the ring drained as fast as it fills
+    SampleRing sampleRing(SDLSampleSize * ffmpeg.getNbOfChannels() *
+                          ringCallbacks);
+    PacketChannel packetChannel(packetChannelSize);
+    std::atomic<bool> isDecoded(false);
+    const Clock::time_point start = Clock::now();
+    std::thread demuxThread(
+        [&ffmpeg, &packetChannel]() { ffmpeg.read(packetChannel); });
+    std::thread decodeThread([&ffmpeg, &packetChannel, &sampleRing,
+                              &isDecoded]() {
+      ffmpeg.bufferData(packetChannel, sampleRing, false);
+      isDecoded = true;
+    });
+
+    std::vector<float> samples(sampleRing.getCapacity());
+    std::uint64_t nbSamples = 0;
+    while (!isDecoded || sampleRing.size() > 0) {
+      const std::size_t read = sampleRing.read(samples.data(), samples.size());
+      nbSamples += read;
+      if (read == 0) {
+        std::this_thread::yield();
+      }
+    }
+    demuxThread.join();
+    decodeThread.join();
+    const std::chrono::duration<double> wallTime = Clock::now() - start;
+
+    const double audioSeconds = static_cast<double>(nbSamples) /
+                                ffmpeg.getNbOfChannels() /
+                                ffmpeg.getSampleRate();
+    os << (threadCount == 0 ? std::string("auto")
+                            : std::to_string(threadCount))
+       << " codec threads : " << audioSeconds << " s of audio in "
+       << wallTime.count() << " s, x" << audioSeconds / wallTime.count()
+       << " realtime, decoder alone x" << ffmpeg.getDecodeSpeed() << "\n";
+  }
+}
+
+CustomAvioContext::CustomAvioContext(const Http::StreamBuffer &input)
+    : _data(input),
+      _isStopped(false),
       _pos(0),
-      _buffer(static_cast<uint8_t *>(::av_malloc(_data.size()))),
-      _context(avio_alloc_context(_buffer, _data.size(),
+      _buffer(static_cast<uint8_t *>(::av_malloc(avioBufferSize))),
+      _context(avio_alloc_context(_buffer, avioBufferSize,
                                   // not writable
                                   0, this, &CustomAvioContext::read,
                                   // write fct ptr
@@ -203,14 +413,22 @@ int CustomAvioContext::read(void *userData, std::uint8_t *buffer,
   }
 
   CustomAvioContext *ctx = static_cast<CustomAvioContext *>(userData);
-  const int count =
-      std::min(static_cast<int>(ctx->_data.size() - ctx->_pos), bufferSize);
-
-  std::memcpy(buffer,
-              reinterpret_cast<const uint8_t *>(ctx->_data.data() + ctx->_pos),
-              count);
+  // waits only if the decoder is ahead of the download
+  const std::size_t count = ctx->_data.read(
+      ctx->_pos, reinterpret_cast<char *>(buffer), bufferSize);
+  if (count == 0) {
+    if (ctx->_isStopped) {
+      return AVERROR_EXIT;
+    }
+    // a body cut by a failed download is not the end of the song
+    if (ctx->_data.getError()) {
+      LOG_ERROR << "download failed after " << ctx->_pos << " bytes";
+      return AVERROR(EIO);
+    }
+    return AVERROR_EOF;
+  }
   ctx->_pos += count;
-  return count;
+  return static_cast<int>(count);
 }
 
 int64_t CustomAvioContext::seek(void *userData, int64_t offset, int whence) {
@@ -220,13 +438,25 @@ int64_t CustomAvioContext::seek(void *userData, int64_t offset, int whence) {
   }
 
   CustomAvioContext *ctx = static_cast<CustomAvioContext *>(userData);
+  const boost::optional<std::uint64_t> size = ctx->_data.getExpectedSize();
 
-  switch (whence) {
-    case AVIO_SEEKABLE_NORMAL:
+  // seeking past the received data is fine, next read waits for it
+  switch (whence & ~AVSEEK_FORCE) {
+    case SEEK_SET:
       ctx->_pos = offset;
       return ctx->_pos;
+    case SEEK_CUR:
+      ctx->_pos += offset;
+      return ctx->_pos;
+    case SEEK_END:
+      if (!size) {
+        LOG << "customAvio context seek from end, size still unknown";
+        return -1;
+      }
+      ctx->_pos = *size + offset;
+      return ctx->_pos;
     case AVSEEK_SIZE:
-      return ctx->_data.size();
+      return size ? static_cast<int64_t>(*size) : -1;
     default:
       LOG << "customAvio context seek unrecognized whence value: " << whence;
       return -1;
@@ -235,26 +465,35 @@ int64_t CustomAvioContext::seek(void *userData, int64_t offset, int whence) {
 
 ::AVIOContext *CustomAvioContext::getContext() { return _context; }
 
-FFmpegWrapper::FFmpegWrapper(const std::string &data)
+void CustomAvioContext::stop() {
+  _isStopped = true;
+  _data.abort();
+}
+
+FFmpegWrapper::FFmpegWrapper(const Http::StreamBuffer &data,
+                             int nbDecodeThreads)
     : _customCtx(data),
       _formatCtx(::avformat_alloc_context()),
       _audioStream(nullptr),
       _codec(nullptr),
       _codecCtx(nullptr),
-      _isInit(false) {
+      _isInit(false),
+      _isStopped(false),
+      _nbDecodedSamples(0),
+      _decodeNs(0) {
   _formatCtx->pb = _customCtx.getContext();
-  _isInit = init();
+  _isInit = init(nbDecodeThreads);
 }
 
 FFmpegWrapper::~FFmpegWrapper() {
   LOG << "close codec ctx ";
-  avcodec_close(_codecCtx);
+  avcodec_free_context(&_codecCtx);
 
   LOG << "close format input";
   avformat_close_input(&_formatCtx);
 }
 
-bool FFmpegWrapper::init() {
+bool FFmpegWrapper::init(int nbDecodeThreads) {
   int err = avformat_open_input(
       &_formatCtx, "no file, we look in memory with custom context", nullptr,
       nullptr);
@@ -281,12 +520,39 @@ bool FFmpegWrapper::init() {
     LOG << "audio stream found";
   }
 
-  _codecCtx = _formatCtx->streams[_idxAudioStream]->codec;
+  _codecCtx = ::avcodec_alloc_context3(_codec);
   if (_codecCtx == nullptr || _codec == nullptr) {
     LOG << "could not find codec context";
     return false;
   }
-  _codecCtx->codec = _codec;
+  err = ::avcodec_parameters_to_context(
+      _codecCtx, _formatCtx->streams[_idxAudioStream]->codecpar);
+  if (err < 0) {
+    LOG << "avcodec_parameters_to_context error : " << err;
+    return false;
+  }
+
+  // 0 lets ffmpeg pick, only used by decoders that support it
+  if (nbDecodeThreads != 1 &&
+      (_codec->capabilities &
+       (AV_CODEC_CAP_FRAME_THREADS | AV_CODEC_CAP_SLICE_THREADS)) == 0) {
+    LOG << "codec " << _codec->name << " decodes on one thread only";
+  }
+  _codecCtx->thread_count = nbDecodeThreads;
+  _codecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+  err = ::avcodec_open2(_codecCtx, _codec, nullptr);
+  if (err != 0) {
+    LOG << "could not open codec : " << err;
+    return false;
+  }
+  LOG << "codec " << _codec->name << " opened with "
+      << _codecCtx->thread_count << " threads";
+
+  // converting other formats would need swresample
+  if (::av_get_packed_sample_fmt(_codecCtx->sample_fmt) != FrameFormat) {
+    LOG << "unsupported sample format : " << _codecCtx->sample_fmt;
+    return false;
+  }
 
   return true;
 }
@@ -303,81 +569,114 @@ int FFmpegWrapper::getNbOfChannels() const {
 
 bool FFmpegWrapper::isInit() const { return _isInit; }
 
-void FFmpegWrapper::read(PacketChannel &packetChannel) {
-  if (avcodec_open2(_codecCtx, _codec, nullptr) != 0) {
-    LOG << "could open codec";
-    packetChannel.close();
-    return;
+bool FFmpegWrapper::isStopped() const { return _isStopped.load(); }
+
+void FFmpegWrapper::stop() {
+  _isStopped = true;
+  // the demux thread may wait for the network inside av_read_frame
+  _customCtx.stop();
+}
+
+double FFmpegWrapper::getDecodeSpeed() const {
+  const std::uint64_t decodeNs = _decodeNs.load();
+  if (decodeNs == 0) {
+    return 0.;
   }
-  SDL_Event event;
+  // seconds of audio decoded per second spent decoding
+  return static_cast<double>(_nbDecodedSamples.load()) * 1e9 /
+         getSampleRate() / decodeNs;
+}
+
+void FFmpegWrapper::read(PacketChannel &packetChannel) {
   int retRead = 0;
-  while (retRead == 0) {
+  while (!isStopped()) {
     AVPacket *packet = getPool().acquire();
     retRead = ::av_read_frame(_formatCtx, packet);
-
-    if (packet->stream_index == _idxAudioStream) {
-      packetChannel.push(packet);
-    } else {
+    if (retRead != 0) {
       getPool().release(packet);
+      break;
     }
 
-    SDL_PollEvent(&event);
-    switch (event.type) {
-      case SDL_QUIT:
-        LOG << "SDL_QUIT";
-        SDL_Quit();
-        retRead = -9999;
-        return;
-      default:
-        break;
+    if (packet->stream_index != _idxAudioStream ||
+        packetChannel.push(packet) !=
+            boost::fibers::channel_op_status::success) {
+      getPool().release(packet);
     }
   }
-  if (retRead != 0) {
-    LOG << "av_read_frame returned " << retRead;
+  if (retRead == AVERROR_EOF) {
+    LOG << "av_read_frame reached the end of the stream";
+  } else if (retRead == AVERROR_EXIT) {
+    LOG << "av_read_frame stopped";
+  } else if (retRead != 0) {
+    LOG_ERROR << "av_read_frame error : " << retRead;
   }
   packetChannel.close();
 }
 
 std::vector<float> FFmpegWrapper::bufferData(PacketChannel &packetChannel,
-                                             DataChannel &dataChannel) {
+                                             SampleRing &sampleRing,
+                                             bool isKeepingSamples) {
   ::AVPacket *packet;
   ::AVFrame *frame = ::av_frame_alloc();
   std::vector<float> songData;
   if (frame == nullptr) {
     LOG << "could not allocate frame ";
     ::av_frame_free(&frame);
-    dataChannel.close();
     return songData;
   }
 
-  songData.reserve(4096);
-
-  while (boost::fibers::channel_op_status::success ==
-         packetChannel.pop(packet)) {
-    std::size_t read = 0;
-    while (read < packet->size) {
-      int hasFrame = 0;
-
-      const int retDecode =
-          ::avcodec_decode_audio4(_codecCtx, frame, &hasFrame, packet);
-      if (retDecode < 0) {
-        LOG << "error decode audio 4 : " << retDecode;
-        break;
+  // one frame of interleaved samples, grows to the largest frame only
+  std::vector<float> interleaved;
+  const int nbChannels = getNbOfChannels();
+  typedef std::chrono::steady_clock Clock;
+
+  // sends one packet, nullptr drains the decoder, then pushes every frame
+  // it completed, false once playback is stopped
+  auto decode = [&](const ::AVPacket *toSend) {
+    // waits on the ring are not decode time
+    Clock::time_point start = Clock::now();
+    const auto addDecodeTime = [this, &start]() {
+      _decodeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       Clock::now() - start)
+                       .count();
+    };
+
+    int ret = ::avcodec_send_packet(_codecCtx, toSend);
+    if (ret < 0) {
+      LOG << "avcodec_send_packet error : " << ret;
+    }
+    while ((ret = ::avcodec_receive_frame(_codecCtx, frame)) == 0) {
+      interleave(*frame, nbChannels, interleaved);
+      _nbDecodedSamples += frame->nb_samples;
+      addDecodeTime();
+
+      if (!pushSamples(sampleRing, interleaved.data(), interleaved.size(),
+                       *this)) {
+        return false;
       }
-      read += retDecode;
-
-      if (hasFrame) {
-        float **data = reinterpret_cast<float **>(frame->data);
-        for (int smp = 0; smp < frame->nb_samples; ++smp) {
-          for (int chn = 0; chn < getNbOfChannels(); ++chn) {
-            dataChannel.push(data[chn][smp]);
-            songData.push_back(data[chn][smp]);
-          }
-        }
+      if (isKeepingSamples) {
+        songData.insert(songData.end(), interleaved.begin(),
+                        interleaved.end());
       }
+      start = Clock::now();
+    }
+    addDecodeTime();
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+      LOG << "avcodec_receive_frame error : " << ret;
     }
+    return true;
+  };
+
+  bool isPlaying = true;
+  while (isPlaying && boost::fibers::channel_op_status::success ==
+                          packetChannel.pop(packet)) {
+    isPlaying = decode(packet);
     getPool().release(packet);
   }
+  // frames still held by the decoder, several with frame threading
+  if (isPlaying) {
+    decode(nullptr);
+  }
   LOG << "end bufferData";
 
   ::av_frame_free(&frame);
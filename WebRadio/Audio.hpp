@@ -20,7 +20,10 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef AUDIO_HPP
 #define AUDIO_HPP
 
+#include <atomic>
 #include <boost/fiber/all.hpp>
+#include <chrono>
+#include <cstdint>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -32,27 +35,80 @@ extern "C" {
 
 #include <SDL2/SDL.h>
 
+#include "Http.hpp"
+#include "SampleRing.hpp"
+#include "Utils.hpp"
+
 namespace Audio {
 typedef boost::fibers::buffered_channel<::AVPacket *> PacketChannel;
-typedef boost::fibers::buffered_channel<float> DataChannel;
 
-void playAudio(const std::string &, bool isRepeat);
+// filled by the SDL callback with atomics only, readable from any thread
+class CallbackStats {
+  std::atomic<std::uint64_t> _nbCallbacks;
+  // callbacks that did not get all their samples once playback started
+  std::atomic<std::uint64_t> _nbUnderruns;
+  std::atomic<std::uint64_t> _nbMissingSamples;
+  std::atomic<bool> _hasStarted;
+  // callback execution time, in nanoseconds
+  Utils::Histogram _duration;
+
+  friend std::ostream &operator<<(std::ostream &, const CallbackStats &);
+
+ public:
+  CallbackStats();
+  CallbackStats(const CallbackStats &) = delete;
+  CallbackStats(CallbackStats &&) = delete;
+
+  void record(std::size_t nbRequested, std::size_t nbRead,
+              std::uint64_t durationNs);
+
+  std::uint64_t getNbCallbacks() const;
+  std::uint64_t getNbUnderruns() const;
+};
+
+std::ostream &operator<<(std::ostream &, const CallbackStats &);
+
+CallbackStats &getCallbackStats();
+
+struct PlayOptions {
+  PlayOptions();
+
+  bool _isRepeat;
+  // audio decoded ahead of the SDL callback
+  std::chrono::milliseconds _decodeAhead;
+  // codec threads, 0 lets ffmpeg pick one per core, the aac and opus
+  // decoders have no threading so 1 by default
+  int _nbDecodeThreads;
+};
+
+// starts as soon as the stream holds enough data to probe the format, demux
+// and decode run on their own threads and keep up to _decodeAhead of audio
+// ready for the SDL callback
+void playAudio(const Http::StreamBuffer &, const PlayOptions &);
+
+// decodes the whole stream without playing it, with 1 codec thread then
+// nbDecodeThreads, and prints the throughputs
+void benchmarkDecode(const Http::StreamBuffer &, int nbDecodeThreads,
+                     std::ostream &);
 
 class CustomAvioContext {
  public:
-  CustomAvioContext(std::string);
+  CustomAvioContext(const Http::StreamBuffer &);
   ~CustomAvioContext();
   CustomAvioContext(const CustomAvioContext &) = delete;
   CustomAvioContext(CustomAvioContext &&) = delete;
 
   ::AVIOContext *getContext();
+  // a read waiting for the download returns AVERROR_EXIT, from any thread
+  void stop();
 
   static int read(void *userData, uint8_t *buffer, int bufferSize);
 
   static int64_t seek(void *userData, int64_t offset, int whence);
 
  private:
-  std::string _data;
+  const Http::StreamBuffer &_data;
+  std::atomic<bool> _isStopped;
   std::size_t _pos;
   uint8_t *_buffer;
   ::AVIOContext *_context;
@@ -61,7 +117,7 @@ class CustomAvioContext {
 class FFmpegWrapper {
   // this legacy C API must be quarantained :)
  public:
-  FFmpegWrapper(const std::string &);
+  FFmpegWrapper(const Http::StreamBuffer &, int nbDecodeThreads);
   ~FFmpegWrapper();
   FFmpegWrapper(const FFmpegWrapper &) = delete;
   FFmpegWrapper(FFmpegWrapper &&) = delete;
@@ -69,13 +125,21 @@ class FFmpegWrapper {
   int getSampleRate() const;
   int getNbOfChannels() const;
   bool isInit() const;
+  bool isStopped() const;
+  // read and bufferData return as soon as they see it, a read waiting for
+  // the download is woken up
+  void stop();
+  // times faster than realtime, waits for packets or ring room excluded
+  double getDecodeSpeed() const;
 
   void read(PacketChannel &packetChannel);
+  // decoded samples go interleaved to the ring, also returned for replay
+  // when kept
   std::vector<float> bufferData(PacketChannel &packetChannel,
-                                DataChannel &dataChannel);
+                                SampleRing &sampleRing, bool isKeepingSamples);
 
  private:
-  bool init();
+  bool init(int nbDecodeThreads);
 
   CustomAvioContext _customCtx;
   ::AVFormatContext *_formatCtx;
@@ -84,6 +148,10 @@ class FFmpegWrapper {
   ::AVCodecContext *_codecCtx;
   int _idxAudioStream;
   bool _isInit;
+  std::atomic<bool> _isStopped;
+  // written by the decode thread
+  std::atomic<std::uint64_t> _nbDecodedSamples;
+  std::atomic<std::uint64_t> _decodeNs;
 };
 
 }  // namespace Audio
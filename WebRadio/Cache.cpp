@@ -0,0 +1,287 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "Utils.hpp"
+
+namespace Http {
+
+namespace {
+
+std::string makeKey(const std::string &host, const std::string &target) {
+  return host + target;
+}
+
+// FNV-1a, names the body files the same way on every run
+std::string hashKey(const std::string &key) {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (const char c : key) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  std::ostringstream oss;
+  oss << std::hex << hash;
+  return oss.str();
+}
+
+// max-age of a Cache-Control value, -1 if the body must not be reused
+// without revalidation
+long parseMaxAge(const std::string &cacheControl) {
+  if (cacheControl.find("no-cache") != std::string::npos) {
+    return -1;
+  }
+  static const std::string maxAgeTag("max-age=");
+  const std::size_t beginMaxAge = cacheControl.find(maxAgeTag);
+  if (beginMaxAge == std::string::npos) {
+    return -1;
+  }
+  try {
+    return std::stol(cacheControl.substr(beginMaxAge + maxAgeTag.size()));
+  } catch (const std::exception &) {
+    return -1;
+  }
+}
+
+}  // namespace
+
+ResponseCache::Entry::Entry()
+    : _etag(),
+      _lastModified(),
+      _expiry(0),
+      _storedAt(0),
+      _size(0),
+      _bodyFilePath() {}
+
+ResponseCache::ResponseCache(std::string filePath, std::uint64_t maxSize,
+                             std::time_t maxAge)
+    : _mutex(),
+      _filePath(std::move(filePath)),
+      _maxSize(maxSize),
+      _maxAge(maxAge),
+      _entries(),
+      _immutableHosts(),
+      _nbFresh(0),
+      _nbStale(0),
+      _nbMisses(0),
+      _pendingWrites(),
+      _writeCondition(),
+      _isStopping(false),
+      _writer() {
+  load();
+  _writer = std::thread([this]() { writeLoop(); });
+}
+
+ResponseCache::~ResponseCache() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _isStopping = true;
+  }
+  _writeCondition.notify_one();
+  // pending bodies are still written
+  _writer.join();
+  logStats();
+  save();
+}
+
+void ResponseCache::setImmutable(const std::string &host) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _immutableHosts.insert(host);
+}
+
+ResponseCache::Lookup ResponseCache::find(const std::string &host,
+                                          const std::string &target,
+                                          Entry &entry) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto itEntry = _entries.find(makeKey(host, target));
+  if (itEntry == _entries.end()) {
+    ++_nbMisses;
+    return Lookup::miss;
+  }
+  entry = itEntry->second;
+  if (_immutableHosts.count(host) > 0 || std::time(nullptr) < entry._expiry) {
+    ++_nbFresh;
+    return Lookup::fresh;
+  }
+  ++_nbStale;
+  return Lookup::stale;
+}
+
+bool ResponseCache::readBody(const Entry &entry, std::string &body) const {
+  std::ifstream ifs(entry._bodyFilePath,
+                    std::ifstream::binary | std::ifstream::ate);
+  if (!ifs) {
+    LOG << "cached body " << entry._bodyFilePath << " is gone";
+    return false;
+  }
+  body.resize(static_cast<std::size_t>(ifs.tellg()));
+  ifs.seekg(0, std::ifstream::beg);
+  return body.empty() || static_cast<bool>(ifs.read(&body[0], body.size()));
+}
+
+void ResponseCache::store(const std::string &host, const std::string &target,
+                          const std::string &etag,
+                          const std::string &lastModified,
+                          const std::string &cacheControl,
+                          const std::string &body) {
+  const long maxAge = parseMaxAge(cacheControl);
+  bool isImmutable = false;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    isImmutable = _immutableHosts.count(host) > 0;
+  }
+  if (cacheControl.find("no-store") != std::string::npos ||
+      (etag.empty() && lastModified.empty() && maxAge <= 0 && !isImmutable)) {
+    return;
+  }
+
+  PendingWrite pending;
+  pending._key = makeKey(host, target);
+  pending._entry._etag = etag;
+  pending._entry._lastModified = lastModified;
+  pending._entry._storedAt = std::time(nullptr);
+  pending._entry._expiry = maxAge > 0 ? pending._entry._storedAt + maxAge : 0;
+  pending._entry._size = body.size();
+  pending._entry._bodyFilePath = _filePath + "." + hashKey(pending._key);
+  pending._body = body;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pendingWrites.push_back(std::move(pending));
+  }
+  _writeCondition.notify_one();
+}
+
+void ResponseCache::writeLoop() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (;;) {
+    _writeCondition.wait(
+        lock, [this]() { return _isStopping || !_pendingWrites.empty(); });
+    if (_pendingWrites.empty()) {
+      return;
+    }
+    PendingWrite pending = std::move(_pendingWrites.front());
+    _pendingWrites.pop_front();
+
+    lock.unlock();
+    std::ofstream ofs(pending._entry._bodyFilePath,
+                      std::ofstream::binary | std::ofstream::trunc);
+    const bool isWritten = static_cast<bool>(
+        ofs.write(pending._body.data(), pending._body.size()));
+    ofs.close();
+    lock.lock();
+
+    if (!isWritten) {
+      LOG << "could not cache " << pending._key << " in "
+          << pending._entry._bodyFilePath;
+      continue;
+    }
+    LOG << pending._key << " cached, " << pending._body.size() << " bytes";
+    _entries[pending._key] = std::move(pending._entry);
+    evict();
+  }
+}
+
+void ResponseCache::evict() {
+  const std::time_t now = std::time(nullptr);
+  std::uint64_t totalSize = 0;
+  for (auto itEntry = _entries.begin(); itEntry != _entries.end();) {
+    if (itEntry->second._storedAt + _maxAge < now) {
+      LOG << itEntry->first << " evicted from cache, too old";
+      std::remove(itEntry->second._bodyFilePath.c_str());
+      itEntry = _entries.erase(itEntry);
+    } else {
+      totalSize += itEntry->second._size;
+      ++itEntry;
+    }
+  }
+  while (totalSize > _maxSize && !_entries.empty()) {
+    auto itOldest = std::min_element(
+        _entries.begin(), _entries.end(), [](const auto &a, const auto &b) {
+          return a.second._storedAt < b.second._storedAt;
+        });
+    LOG << itOldest->first << " evicted from cache, " << totalSize
+        << " bytes cached";
+    totalSize -= itOldest->second._size;
+    std::remove(itOldest->second._bodyFilePath.c_str());
+    _entries.erase(itOldest);
+  }
+}
+
+void ResponseCache::erase(const std::string &host, const std::string &target) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto itEntry = _entries.find(makeKey(host, target));
+  if (itEntry != _entries.end()) {
+    std::remove(itEntry->second._bodyFilePath.c_str());
+    _entries.erase(itEntry);
+  }
+}
+
+void ResponseCache::load() {
+  // one line per url : key \t expiry \t stored at \t size \t etag \t
+  // last modified \t body file
+  std::ifstream ifs(_filePath);
+  std::string line;
+  std::lock_guard<std::mutex> lock(_mutex);
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string key;
+    std::string expiry;
+    std::string storedAt;
+    std::string size;
+    Entry entry;
+    if (!std::getline(iss, key, '\t') || !std::getline(iss, expiry, '\t') ||
+        !std::getline(iss, storedAt, '\t') ||
+        !std::getline(iss, size, '\t') ||
+        !std::getline(iss, entry._etag, '\t') ||
+        !std::getline(iss, entry._lastModified, '\t') ||
+        !std::getline(iss, entry._bodyFilePath)) {
+      continue;
+    }
+    entry._expiry = static_cast<std::time_t>(std::atoll(expiry.c_str()));
+    entry._storedAt = static_cast<std::time_t>(std::atoll(storedAt.c_str()));
+    entry._size = std::strtoull(size.c_str(), nullptr, 10);
+    _entries[key] = std::move(entry);
+  }
+  evict();
+  LOG << _entries.size() << " responses loaded from " << _filePath;
+}
+
+void ResponseCache::save() const {
+  std::ofstream ofs(_filePath, std::ofstream::trunc);
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto &entry : _entries) {
+    ofs << entry.first << "\t" << entry.second._expiry << "\t"
+        << entry.second._storedAt << "\t" << entry.second._size << "\t"
+        << entry.second._etag << "\t" << entry.second._lastModified << "\t"
+        << entry.second._bodyFilePath << "\n";
+  }
+}
+
+void ResponseCache::logStats() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  LOG << "response cache : " << _nbFresh << " fresh, " << _nbStale
+      << " revalidated, " << _nbMisses << " misses";
+}
+
+}  // namespace Http
@@ -0,0 +1,121 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CACHE_HPP_
+#define CACHE_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace Http {
+
+// on disk cache of GET bodies with their validators. A fresh entry (within
+// its max-age, or any entry of an immutable host) is served without any
+// request, a stale one is revalidated with If-None-Match / If-Modified-Since
+// and served from disk on a 304. The index lives in filePath, each body in
+// filePath.<hash>. Bodies are written by a thread of the cache, entries older
+// than maxAge are dropped and the oldest ones go once maxSize is exceeded
+class ResponseCache {
+ public:
+  enum class Lookup {
+    miss,
+    fresh,
+    // must be revalidated
+    stale,
+  };
+
+  struct Entry {
+    Entry();
+
+    std::string _etag;
+    std::string _lastModified;
+    // 0 when the entry must always be revalidated
+    std::time_t _expiry;
+    std::time_t _storedAt;
+    std::uint64_t _size;
+    std::string _bodyFilePath;
+  };
+
+ private:
+  struct PendingWrite {
+    std::string _key;
+    Entry _entry;
+    std::string _body;
+  };
+
+  mutable std::mutex _mutex;
+  std::string _filePath;
+  std::uint64_t _maxSize;
+  std::time_t _maxAge;
+  std::map<std::string, Entry> _entries;
+  std::set<std::string> _immutableHosts;
+  std::size_t _nbFresh;
+  std::size_t _nbStale;
+  std::size_t _nbMisses;
+
+  // an entry is only visible once its body is on disk
+  std::deque<PendingWrite> _pendingWrites;
+  std::condition_variable _writeCondition;
+  bool _isStopping;
+  std::thread _writer;
+
+  void load();
+  void save() const;
+  void writeLoop();
+  // removes expired entries then the oldest ones above _maxSize, _mutex held
+  void evict();
+
+ public:
+  explicit ResponseCache(std::string filePath,
+                         std::uint64_t maxSize = 64 * 1024 * 1024,
+                         std::time_t maxAge = 30 * 24 * 3600);
+  ~ResponseCache();
+  ResponseCache(const ResponseCache &) = delete;
+  ResponseCache(ResponseCache &&) = delete;
+
+  // every path of host carries its version, e.g. a player script, so its
+  // content never changes once cached
+  void setImmutable(const std::string &host);
+
+  // entry is filled unless nothing is cached for this url
+  Lookup find(const std::string &host, const std::string &target,
+              Entry &entry);
+  // body of a found entry, false if its file is gone
+  bool readBody(const Entry &entry, std::string &body) const;
+
+  // keeps a 200 response unless it has nothing to be revalidated with, the
+  // body is copied and written later without blocking the caller
+  void store(const std::string &host, const std::string &target,
+             const std::string &etag, const std::string &lastModified,
+             const std::string &cacheControl, const std::string &body);
+  void erase(const std::string &host, const std::string &target);
+
+  void logStats() const;
+};
+
+}  // namespace Http
+
+#endif /* CACHE_HPP_ */
@@ -0,0 +1,201 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Compression.hpp"
+
+#include <brotli/decode.h>
+#include <zlib.h>
+
+#include <boost/beast/http/error.hpp>
+
+#include "Utils.hpp"
+
+namespace Http {
+
+const char *const acceptedEncodings = "gzip, deflate, br";
+
+namespace {
+
+// output grows by this much while a piece is decoded
+static const std::size_t decodeChunkSize = 64 * 1024;
+
+// gzip and zlib wrapped deflate, the header tells them apart, raw deflate
+// sent by some servers for "deflate" is detected by the header error
+class GzipDecoder : public ContentDecoder {
+  ::z_stream _stream;
+  bool _isInitialized;
+  bool _isRaw;
+  bool _isComplete;
+
+ public:
+  GzipDecoder()
+      : _stream(), _isInitialized(false), _isRaw(false), _isComplete(false) {
+    // 32 detects the gzip or zlib header
+    _isInitialized = ::inflateInit2(&_stream, MAX_WBITS + 32) == Z_OK;
+  }
+  ~GzipDecoder() override {
+    if (_isInitialized) {
+      ::inflateEnd(&_stream);
+    }
+  }
+
+  bool decode(const char *data, std::size_t size,
+              std::string &output) override {
+    if (!_isInitialized) {
+      return false;
+    }
+    // the header is in the first piece
+    const bool isFirstPiece = _stream.total_in == 0;
+    _stream.next_in =
+        reinterpret_cast<::Bytef *>(const_cast<char *>(data));
+    _stream.avail_in = static_cast<::uInt>(size);
+    // trailing bytes after the end of the stream are ignored
+    while (!_isComplete && (_stream.avail_in > 0 || _stream.avail_out == 0)) {
+      const std::size_t pos = output.size();
+      output.resize(pos + decodeChunkSize);
+      _stream.next_out = reinterpret_cast<::Bytef *>(&output[pos]);
+      _stream.avail_out = static_cast<::uInt>(decodeChunkSize);
+      const int ret = ::inflate(&_stream, Z_NO_FLUSH);
+      output.resize(pos + decodeChunkSize - _stream.avail_out);
+      if (ret == Z_STREAM_END) {
+        _isComplete = true;
+      } else if (ret == Z_BUF_ERROR) {
+        // needs more input
+        break;
+      } else if (ret == Z_DATA_ERROR && isFirstPiece && !_isRaw &&
+                 _stream.total_out == 0) {
+        // no gzip or zlib header, decodes the piece again as raw deflate
+        _isRaw = true;
+        if (::inflateReset2(&_stream, -MAX_WBITS) != Z_OK) {
+          return false;
+        }
+        _stream.next_in =
+            reinterpret_cast<::Bytef *>(const_cast<char *>(data));
+        _stream.avail_in = static_cast<::uInt>(size);
+      } else if (ret != Z_OK) {
+        LOG << "inflate error " << ret;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool isComplete() const override { return _isComplete; }
+};
+
+class BrotliDecoder : public ContentDecoder {
+  ::BrotliDecoderState *_state;
+  bool _isComplete;
+
+ public:
+  BrotliDecoder()
+      : _state(::BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)),
+        _isComplete(false) {}
+  ~BrotliDecoder() override {
+    if (_state != nullptr) {
+      ::BrotliDecoderDestroyInstance(_state);
+    }
+  }
+
+  bool decode(const char *data, std::size_t size,
+              std::string &output) override {
+    if (_state == nullptr) {
+      return false;
+    }
+    const std::uint8_t *nextIn = reinterpret_cast<const std::uint8_t *>(data);
+    std::size_t availIn = size;
+    ::BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+    while (!_isComplete && result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+      const std::size_t pos = output.size();
+      output.resize(pos + decodeChunkSize);
+      std::uint8_t *nextOut = reinterpret_cast<std::uint8_t *>(&output[pos]);
+      std::size_t availOut = decodeChunkSize;
+      result = ::BrotliDecoderDecompressStream(_state, &availIn, &nextIn,
+                                               &availOut, &nextOut, nullptr);
+      output.resize(pos + decodeChunkSize - availOut);
+      if (result == BROTLI_DECODER_RESULT_SUCCESS) {
+        _isComplete = true;
+      } else if (result == BROTLI_DECODER_RESULT_ERROR) {
+        LOG << "brotli error : "
+            << ::BrotliDecoderErrorString(::BrotliDecoderGetErrorCode(_state));
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool isComplete() const override { return _isComplete; }
+};
+
+}  // namespace
+
+std::unique_ptr<ContentDecoder> ContentDecoder::create(
+    boost::string_view encoding) {
+  if (encoding == "gzip" || encoding == "x-gzip" || encoding == "deflate") {
+    return std::unique_ptr<ContentDecoder>(new GzipDecoder());
+  }
+  if (encoding == "br") {
+    return std::unique_ptr<ContentDecoder>(new BrotliDecoder());
+  }
+  if (!encoding.empty() && encoding != "identity") {
+    LOG << "unsupported content encoding " << encoding << ", body kept as is";
+  }
+  return nullptr;
+}
+
+void DecodedBody::reader::init(
+    const boost::optional<std::uint64_t> &contentLength,
+    boost::system::error_code &err) {
+  const boost::string_view encoding = _getEncoding();
+  _encoding.assign(encoding.data(), encoding.size());
+  _decoder = ContentDecoder::create(_encoding);
+  // a compressed length says little about the decoded size
+  if (contentLength && !_decoder) {
+    _body.reserve(static_cast<std::size_t>(*contentLength));
+  }
+  err.assign(0, err.category());
+}
+
+bool DecodedBody::reader::put(const char *data, std::size_t size,
+                              boost::system::error_code &err) {
+  _nbEncodedBytes += size;
+  if (!_decoder) {
+    _body.append(data, size);
+  } else if (!_decoder->decode(data, size, _body)) {
+    err = boost::beast::http::error::bad_transfer_encoding;
+    return false;
+  }
+  err.assign(0, err.category());
+  return true;
+}
+
+void DecodedBody::reader::finish(boost::system::error_code &err) {
+  if (_decoder && !_decoder->isComplete()) {
+    LOG << _encoding << " body cut after " << _nbEncodedBytes << " bytes";
+    err = boost::beast::http::error::partial_message;
+    return;
+  }
+  if (_decoder) {
+    LOG << _encoding << " body decoded : " << _nbEncodedBytes << " -> "
+        << _body.size() << " bytes";
+  }
+  err.assign(0, err.category());
+}
+
+}  // namespace Http
@@ -0,0 +1,110 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMPRESSION_HPP_
+#define COMPRESSION_HPP_
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/utility/string_view.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace Http {
+
+// decompresses a Content-Encoding piece by piece as the body arrives
+class ContentDecoder {
+ public:
+  virtual ~ContentDecoder() = default;
+
+  // nullptr for identity and for encodings we don't know
+  static std::unique_ptr<ContentDecoder> create(boost::string_view encoding);
+
+  // appends the decoded bytes to output, false on corrupted data
+  virtual bool decode(const char *data, std::size_t size,
+                      std::string &output) = 0;
+  // false while the encoded stream is not finished
+  virtual bool isComplete() const = 0;
+};
+
+// encodings sent in Accept-Encoding, all of them are decoded
+extern const char *const acceptedEncodings;
+
+// string body that decodes gzip, deflate and br bodies as they are parsed,
+// the compressed body is never stored
+struct DecodedBody {
+  typedef std::string value_type;
+
+  class reader {
+    // header is filled later, the reader is built with the parser
+    std::function<boost::string_view()> _getEncoding;
+    value_type &_body;
+    std::unique_ptr<ContentDecoder> _decoder;
+    std::string _encoding;
+    std::uint64_t _nbEncodedBytes;
+
+   public:
+    template <bool isRequest, class Fields>
+    reader(boost::beast::http::header<isRequest, Fields> &header,
+           value_type &body)
+        : _getEncoding([&header]() {
+            auto itEncoding =
+                header.find(boost::beast::http::field::content_encoding);
+            return itEncoding == header.end() ? boost::string_view()
+                                              : itEncoding->value();
+          }),
+          _body(body),
+          _decoder(),
+          _encoding(),
+          _nbEncodedBytes(0) {}
+
+    void init(const boost::optional<std::uint64_t> &contentLength,
+              boost::system::error_code &err);
+
+    template <class ConstBufferSequence>
+    std::size_t put(const ConstBufferSequence &buffers,
+                    boost::system::error_code &err) {
+      std::size_t nbBytes = 0;
+      for (auto it = boost::asio::buffer_sequence_begin(buffers);
+           it != boost::asio::buffer_sequence_end(buffers); ++it) {
+        const boost::asio::const_buffer buffer = *it;
+        if (!put(static_cast<const char *>(buffer.data()), buffer.size(),
+                 err)) {
+          return nbBytes;
+        }
+        nbBytes += buffer.size();
+      }
+      return nbBytes;
+    }
+
+    void finish(boost::system::error_code &err);
+
+   private:
+    bool put(const char *data, std::size_t size,
+             boost::system::error_code &err);
+  };
+};
+
+}  // namespace Http
+
+#endif /* COMPRESSION_HPP_ */
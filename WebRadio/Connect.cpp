@@ -0,0 +1,178 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Connect.hpp"
+
+#include <map>
+#include <mutex>
+
+#include "Utils.hpp"
+
+namespace Http {
+
+namespace {
+
+// RFC 8305 recommends 250 ms
+static const std::chrono::milliseconds connectionAttemptDelay(250);
+
+class FamilyPreferences {
+  std::mutex _mutex;
+  std::map<std::string, bool> _isV6ByHost;
+
+ public:
+  FamilyPreferences() : _mutex(), _isV6ByHost() {}
+
+  // IPv6 first for unknown hosts, as the RFC says
+  bool isV6Preferred(const std::string &host) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto itHost = _isV6ByHost.find(host);
+    return itHost == _isV6ByHost.end() || itHost->second;
+  }
+
+  void setWinner(const std::string &host, bool isV6) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _isV6ByHost[host] = isV6;
+  }
+};
+
+FamilyPreferences &getFamilyPreferences() {
+  static FamilyPreferences preferences;
+  return preferences;
+}
+
+// alternates families, preferred one first
+Endpoints interleave(const Endpoints &endpoints, bool isV6First) {
+  Endpoints preferred;
+  Endpoints others;
+  for (const tcp::endpoint &endpoint : endpoints) {
+    (endpoint.address().is_v6() == isV6First ? preferred : others)
+        .push_back(endpoint);
+  }
+  Endpoints ordered;
+  ordered.reserve(endpoints.size());
+  for (std::size_t i = 0; i < std::max(preferred.size(), others.size());
+       ++i) {
+    if (i < preferred.size()) {
+      ordered.push_back(preferred[i]);
+    }
+    if (i < others.size()) {
+      ordered.push_back(others[i]);
+    }
+  }
+  return ordered;
+}
+
+}  // namespace
+
+RacingConnect::RacingConnect(const Strand &strand, std::string host,
+                             Endpoints endpoints, Handler handler)
+    : _strand(strand),
+      _host(std::move(host)),
+      _endpoints(interleave(endpoints,
+                            getFamilyPreferences().isV6Preferred(_host))),
+      _handler(std::move(handler)),
+      _sockets(),
+      _staggerTimer(strand),
+      _nbFailed(0),
+      _isDone(false),
+      _lastError(boost::asio::error::host_not_found) {
+  _sockets.reserve(_endpoints.size());
+}
+
+std::shared_ptr<RacingConnect> RacingConnect::start(
+    const Strand &strand, const std::string &host, const Endpoints &endpoints,
+    Handler handler) {
+  std::shared_ptr<RacingConnect> racing = std::make_shared<RacingConnect>(
+      strand, host, endpoints, std::move(handler));
+  racing->startNext();
+  return racing;
+}
+
+void RacingConnect::cancel() {
+  if (_isDone) {
+    return;
+  }
+  LOG << "connection attempts to " << _host << " cancelled";
+  _isDone = true;
+  _staggerTimer.cancel();
+  for (std::unique_ptr<tcp::socket> &socket : _sockets) {
+    boost::system::error_code errClose;
+    socket->close(errClose);
+  }
+  _handler(boost::asio::error::operation_aborted, tcp::socket(_strand),
+           tcp::endpoint());
+}
+
+void RacingConnect::startNext() {
+  if (_isDone || _sockets.size() == _endpoints.size()) {
+    if (!_isDone && _nbFailed == _endpoints.size()) {
+      _isDone = true;
+      _handler(_lastError, tcp::socket(_strand), tcp::endpoint());
+    }
+    return;
+  }
+
+  const std::size_t idx = _sockets.size();
+  _sockets.emplace_back(new tcp::socket(_strand));
+  LOG << "connect attempt " << idx << " to " << _endpoints[idx];
+
+  std::shared_ptr<RacingConnect> self = shared_from_this();
+  _sockets[idx]->async_connect(
+      _endpoints[idx], [self, idx](boost::system::error_code err) {
+        self->onConnect(idx, err);
+      });
+
+  _staggerTimer.expires_after(connectionAttemptDelay);
+  _staggerTimer.async_wait([self](boost::system::error_code err) {
+    // cancelled when an attempt finished first
+    if (!err) {
+      self->startNext();
+    }
+  });
+}
+
+void RacingConnect::onConnect(std::size_t idx, boost::system::error_code err) {
+  if (_isDone) {
+    return;
+  }
+
+  if (err) {
+    LOG << "connect attempt " << idx << " to " << _endpoints[idx]
+        << " failed : " << err.message();
+    _lastError = err;
+    ++_nbFailed;
+    // no need to wait for the stagger, next one starts right away
+    _staggerTimer.cancel();
+    startNext();
+    return;
+  }
+
+  _isDone = true;
+  _staggerTimer.cancel();
+  for (std::size_t i = 0; i < _sockets.size(); ++i) {
+    if (i != idx) {
+      boost::system::error_code errClose;
+      _sockets[i]->close(errClose);
+    }
+  }
+  getFamilyPreferences().setWinner(_host, _endpoints[idx].address().is_v6());
+  _handler(err, std::move(*_sockets[idx]), _endpoints[idx]);
+}
+
+}  // namespace Http
@@ -0,0 +1,78 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONNECT_HPP_
+#define CONNECT_HPP_
+
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <memory>
+
+#include "Dns.hpp"
+
+namespace Http {
+
+// serializes the handlers of one connection, the io_context may be run by
+// several threads
+typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
+
+// happy eyeballs (RFC 8305) : connection attempts to the resolved endpoints
+// start one after the other with a short stagger, or right away when the
+// previous one fails, and the first socket to connect wins. Families are
+// interleaved, starting with the one that won last time for this host, so a
+// dead IPv6 route costs a stagger delay instead of a connect timeout
+class RacingConnect : public std::enable_shared_from_this<RacingConnect> {
+ public:
+  typedef std::function<void(boost::system::error_code, tcp::socket,
+                             const tcp::endpoint &)>
+      Handler;
+
+ private:
+  Strand _strand;
+  std::string _host;
+  Endpoints _endpoints;
+  Handler _handler;
+  std::vector<std::unique_ptr<tcp::socket>> _sockets;
+  boost::asio::steady_timer _staggerTimer;
+  std::size_t _nbFailed;
+  bool _isDone;
+  boost::system::error_code _lastError;
+
+  void startNext();
+  void onConnect(std::size_t idx, boost::system::error_code);
+
+ public:
+  RacingConnect(const Strand &, std::string host, Endpoints endpoints,
+                Handler);
+  RacingConnect(const RacingConnect &) = delete;
+  RacingConnect(RacingConnect &&) = delete;
+
+  // every handler, including the given one, runs on strand
+  static std::shared_ptr<RacingConnect> start(const Strand &strand,
+                                              const std::string &host,
+                                              const Endpoints &endpoints,
+                                              Handler);
+  // closes every attempt, handler gets operation_aborted unless it was
+  // already called. To be called from the strand
+  void cancel();
+};
+
+}  // namespace Http
+
+#endif /* CONNECT_HPP_ */
@@ -0,0 +1,220 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Dns.hpp"
+
+#include <boost/asio/post.hpp>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include "Utils.hpp"
+
+namespace Http {
+
+namespace {
+
+static const std::chrono::seconds defaultTtl(300);
+
+std::string makeKey(const std::string &host, const std::string &port) {
+  return host + ":" + port;
+}
+
+}  // namespace
+
+ResolverCache::ResolverCache()
+    : _mutex(),
+      _entries(),
+      _ttl(defaultTtl),
+      _nbHits(0),
+      _nbMisses(0),
+      _savedTime(0) {}
+
+void ResolverCache::setTtl(std::chrono::seconds ttl) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _ttl = ttl;
+}
+
+void ResolverCache::lookup(boost::asio::io_context &ioService,
+                           const std::string &host, const std::string &port,
+                           Handler handler) {
+  std::shared_ptr<tcp::resolver> resolver =
+      std::make_shared<tcp::resolver>(ioService);
+  const Clock::time_point start = Clock::now();
+  const std::string key = makeKey(host, port);
+
+  resolver->async_resolve(
+      host, port,
+      [this, resolver, start, key, handler](
+          boost::system::error_code err,
+          tcp::resolver::results_type results) {
+        Endpoints endpoints;
+        if (!err) {
+          const Clock::time_point now = Clock::now();
+          endpoints.assign(results.begin(), results.end());
+          std::lock_guard<std::mutex> lock(_mutex);
+          Entry &entry = _entries[key];
+          entry._endpoints = endpoints;
+          entry._resolvedAt = now;
+          entry._resolveTime =
+              std::chrono::duration_cast<std::chrono::microseconds>(now -
+                                                                    start);
+          entry._isRefreshing = false;
+          LOG << key << " resolved in " << entry._resolveTime.count()
+              << " us";
+        } else {
+          LOG << "could not resolve " << key << " : " << err.message();
+          std::lock_guard<std::mutex> lock(_mutex);
+          auto itEntry = _entries.find(key);
+          if (itEntry != _entries.end()) {
+            itEntry->second._isRefreshing = false;
+          }
+        }
+        if (handler) {
+          handler(err, endpoints);
+        }
+      });
+}
+
+void ResolverCache::resolve(boost::asio::io_context &ioService,
+                            const std::string &host, const std::string &port,
+                            Handler handler) {
+  const Clock::time_point now = Clock::now();
+  bool mustRefresh = false;
+  Endpoints endpoints;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto itEntry = _entries.find(makeKey(host, port));
+    if (itEntry != _entries.end() &&
+        now < itEntry->second._resolvedAt + _ttl) {
+      Entry &entry = itEntry->second;
+      endpoints = entry._endpoints;
+      ++_nbHits;
+      _savedTime += entry._resolveTime;
+      // refresh ahead once 3/4 of the ttl is gone
+      if (!entry._isRefreshing && now > entry._resolvedAt + _ttl * 3 / 4) {
+        entry._isRefreshing = true;
+        mustRefresh = true;
+      }
+    } else {
+      ++_nbMisses;
+    }
+  }
+
+  if (endpoints.empty()) {
+    lookup(ioService, host, port, std::move(handler));
+    return;
+  }
+
+  if (mustRefresh) {
+    LOG << "refresh " << host << " ahead of expiry";
+    lookup(ioService, host, port, Handler());
+  }
+  boost::asio::post(ioService, [handler, endpoints]() {
+    handler(boost::system::error_code(), endpoints);
+  });
+}
+
+void ResolverCache::invalidate(const std::string &host,
+                               const std::string &port) {
+  const std::string key = makeKey(host, port);
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_entries.erase(key) > 0) {
+    LOG << key << " removed from the resolver cache";
+  }
+}
+
+void ResolverCache::load(const std::string &filePath) {
+  // one line per host : key expiry_time resolve_time_us address port ...
+  std::ifstream ifs(filePath);
+  const std::time_t nowFile = std::time(nullptr);
+  const Clock::time_point now = Clock::now();
+  std::string line;
+  std::lock_guard<std::mutex> lock(_mutex);
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    std::string key;
+    std::time_t expiry = 0;
+    std::int64_t resolveTime = 0;
+    if (!(iss >> key >> expiry >> resolveTime) || expiry <= nowFile) {
+      continue;
+    }
+    Entry entry;
+    std::string address;
+    unsigned short port = 0;
+    while (iss >> address >> port) {
+      boost::system::error_code err;
+      const boost::asio::ip::address ip =
+          boost::asio::ip::make_address(address, err);
+      if (!err) {
+        entry._endpoints.emplace_back(ip, port);
+      }
+    }
+    if (entry._endpoints.empty()) {
+      continue;
+    }
+    // so that the entry expires at the same wall clock time
+    entry._resolvedAt = now - _ttl + std::chrono::seconds(expiry - nowFile);
+    entry._resolveTime = std::chrono::microseconds(resolveTime);
+    entry._isRefreshing = false;
+    _entries[key] = std::move(entry);
+  }
+  LOG << _entries.size() << " hosts loaded from " << filePath;
+}
+
+void ResolverCache::save(const std::string &filePath) const {
+  std::ofstream ofs(filePath, std::ofstream::trunc);
+  const std::time_t nowFile = std::time(nullptr);
+  const Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto &entry : _entries) {
+    const Clock::time_point expiry = entry.second._resolvedAt + _ttl;
+    if (expiry <= now) {
+      continue;
+    }
+    ofs << entry.first << " "
+        << nowFile + std::chrono::duration_cast<std::chrono::seconds>(
+                         expiry - now)
+                         .count()
+        << " " << entry.second._resolveTime.count();
+    for (const tcp::endpoint &endpoint : entry.second._endpoints) {
+      ofs << " " << endpoint.address().to_string() << " " << endpoint.port();
+    }
+    ofs << "\n";
+  }
+}
+
+std::chrono::microseconds ResolverCache::getSavedTime() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _savedTime;
+}
+
+void ResolverCache::logStats() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  LOG << "resolver cache : " << _nbHits << " hits, " << _nbMisses
+      << " misses, " << _savedTime.count() << " us of resolve saved";
+}
+
+ResolverCache &getResolverCache() {
+  static ResolverCache cache;
+  return cache;
+}
+
+}  // namespace Http
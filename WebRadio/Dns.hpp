@@ -0,0 +1,94 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DNS_HPP_
+#define DNS_HPP_
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Http {
+using tcp = boost::asio::ip::tcp;
+
+typedef std::vector<tcp::endpoint> Endpoints;
+
+// process wide resolver cache : a host resolved once is not resolved again
+// until its entry expires, and entries close to expiry are refreshed in the
+// background while the cached endpoints keep being served.
+// getaddrinfo does not expose record TTLs so every entry lives for the same
+// configurable duration
+class ResolverCache {
+ public:
+  typedef std::function<void(boost::system::error_code, const Endpoints &)>
+      Handler;
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    Endpoints _endpoints;
+    Clock::time_point _resolvedAt;
+    // cost of the last real lookup, saved on every hit
+    std::chrono::microseconds _resolveTime;
+    bool _isRefreshing;
+  };
+
+  mutable std::mutex _mutex;
+  std::map<std::string, Entry> _entries;
+  std::chrono::seconds _ttl;
+  std::size_t _nbHits;
+  std::size_t _nbMisses;
+  std::chrono::microseconds _savedTime;
+
+  void lookup(boost::asio::io_context &, const std::string &host,
+              const std::string &port, Handler);
+
+ public:
+  ResolverCache();
+  ResolverCache(const ResolverCache &) = delete;
+  ResolverCache(ResolverCache &&) = delete;
+
+  void setTtl(std::chrono::seconds ttl);
+
+  // handler is always called from the io_context
+  void resolve(boost::asio::io_context &, const std::string &host,
+               const std::string &port, Handler);
+  // drops the endpoints of host, e.g. when none of them could be reached,
+  // the next resolve looks it up again
+  void invalidate(const std::string &host, const std::string &port);
+
+  // warm cache kept between runs
+  void load(const std::string &filePath);
+  void save(const std::string &filePath) const;
+
+  std::chrono::microseconds getSavedTime() const;
+  void logStats() const;
+};
+
+ResolverCache &getResolverCache();
+
+}  // namespace Http
+
+#endif /* DNS_HPP_ */
@@ -0,0 +1,305 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Download.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Utils.hpp"
+
+namespace Http {
+
+namespace {
+
+static const std::size_t defaultNbConnections = 4;
+static const std::size_t defaultSegmentSize = 1024 * 1024;
+
+bool acceptsRanges(const http::response_header<> &header) {
+  auto itRanges = header.find(http::field::accept_ranges);
+  return itRanges != header.end() && itRanges->value() == "bytes";
+}
+
+// KB per second, 0 when nothing was measured
+std::uint64_t getKbPerSecond(std::uint64_t nbBytes,
+                             std::chrono::milliseconds elapsed) {
+  return elapsed.count() <= 0 ? 0 : nbBytes * 1000 / 1024 / elapsed.count();
+}
+
+// keeps nothing of the body
+class NullSink : public BodySink {
+ public:
+  void onData(const char *, std::size_t) override {}
+};
+
+// one segment, kept in memory while the segments before it are downloaded
+// then streamed to the sink as it arrives. Bytes past its size are dropped
+class SegmentSink : public BodySink {
+  std::mutex _mutex;
+  BodySink *_sink;
+  std::string _buffer;
+  std::uint64_t _nbBytesLeft;
+
+ public:
+  explicit SegmentSink(std::uint64_t size)
+      : _mutex(), _sink(nullptr), _buffer(), _nbBytesLeft(size) {}
+
+  void onData(const char *data, std::size_t size) override {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const std::size_t count =
+        static_cast<std::size_t>(std::min<std::uint64_t>(size, _nbBytesLeft));
+    _nbBytesLeft -= count;
+    if (_sink != nullptr) {
+      _sink->onData(data, count);
+    } else {
+      _buffer.append(data, count);
+    }
+  }
+
+  // once every segment before this one went to sink
+  void forwardTo(BodySink &sink) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_buffer.empty()) {
+      sink.onData(_buffer.data(), _buffer.size());
+    }
+    std::string().swap(_buffer);
+    _sink = &sink;
+  }
+};
+
+}  // namespace
+
+SegmentOptions::SegmentOptions()
+    : _nbConnections(defaultNbConnections), _segmentSize(defaultSegmentSize) {}
+
+SegmentedDownload::SegmentedDownload(boost::asio::io_context &ioService,
+                                     ssl::context &ctx, ConnectionPool &pool,
+                                     SegmentOptions options)
+    : _ioService(ioService),
+      _sslCtx(ctx),
+      _pool(pool),
+      _options(options),
+      _clients() {
+  _options._nbConnections = std::max<std::size_t>(1, _options._nbConnections);
+  _options._segmentSize = std::max<std::size_t>(1, _options._segmentSize);
+  for (std::size_t i = 0; i < _options._nbConnections; ++i) {
+    _clients.emplace_back(new Client(_ioService, _sslCtx, _pool));
+  }
+}
+
+std::size_t SegmentedDownload::runSingleStream(const std::string &host,
+                                               const std::string &port,
+                                               const std::string &target,
+                                               BodySink &sink,
+                                               std::uint64_t offset) {
+  return _clients.front()
+      ->getStream(host, port, target, sink, offset)
+      .get()
+      ._nbBytes;
+}
+
+std::future<RequestStats> SegmentedDownload::launchSegment(
+    std::size_t idxSegment, std::uint64_t offset, std::uint64_t bodySize,
+    const std::string &host, const std::string &port,
+    const std::string &target, BodySink &segmentSink) {
+  const std::uint64_t first = offset + idxSegment * _options._segmentSize;
+  const std::uint64_t last =
+      std::min<std::uint64_t>(first + _options._segmentSize, bodySize) - 1;
+  Client &client = *_clients[idxSegment % _clients.size()];
+  return client.getStream(host, port, target, segmentSink, first, last);
+}
+
+std::size_t SegmentedDownload::run(const std::string &host,
+                                   const std::string &port,
+                                   const std::string &target, BodySink &sink,
+                                   std::uint64_t offset) {
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = Clock::now();
+  const std::size_t nbBytes = runSegments(host, port, target, sink, offset);
+  const std::chrono::milliseconds elapsed =
+      std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                                                            start);
+  LOG << "downloaded " << nbBytes << " bytes in " << elapsed.count()
+      << " ms over " << _clients.size() << " connections, "
+      << getKbPerSecond(nbBytes, elapsed) << " KB/s";
+  return nbBytes;
+}
+
+std::size_t SegmentedDownload::runSegments(const std::string &host,
+                                           const std::string &port,
+                                           const std::string &target,
+                                           BodySink &sink,
+                                           std::uint64_t offset) {
+  if (_clients.size() == 1) {
+    return runSingleStream(host, port, target, sink, offset);
+  }
+
+  Client &probe = *_clients.front();
+  probe.clearRequestRange();
+  probe.head(host, port, target).get();
+  const http::response_header<> &header = probe.getResponseHeader();
+  auto itLength = header.find(http::field::content_length);
+
+  if (header.result() != http::status::ok || !acceptsRanges(header) ||
+      itLength == header.end()) {
+    LOG << "no byte range support on " << host << ", single stream download";
+    return runSingleStream(host, port, target, sink, offset);
+  }
+
+  const std::uint64_t bodySize =
+      std::stoull(std::string(itLength->value().data(),
+                              itLength->value().size()));
+  const std::uint64_t nbBytes = bodySize - std::min(offset, bodySize);
+  if (nbBytes == 0) {
+    LOG << "nothing left to download after byte " << offset;
+    sink.onHeader(nbBytes);
+    sink.onEnd(nullptr);
+    return 0;
+  }
+  const std::size_t nbSegments =
+      (nbBytes + _options._segmentSize - 1) / _options._segmentSize;
+  if (nbSegments <= 1) {
+    return runSingleStream(host, port, target, sink, offset);
+  }
+
+  LOG << "segmented download of " << nbBytes << " bytes in " << nbSegments
+      << " segments over " << _clients.size() << " connections";
+
+  auto getSegmentSize = [this, nbBytes](std::size_t idxSegment) {
+    return std::min<std::uint64_t>(
+        _options._segmentSize, nbBytes - idxSegment * _options._segmentSize);
+  };
+  std::vector<std::future<RequestStats>> segments(_clients.size());
+  std::vector<std::unique_ptr<SegmentSink>> segmentSinks(_clients.size());
+  try {
+    sink.onHeader(nbBytes);
+    for (std::size_t i = 0; i < std::min(nbSegments, _clients.size()); ++i) {
+      segmentSinks[i].reset(new SegmentSink(getSegmentSize(i)));
+      segments[i] = launchSegment(i, offset, bodySize, host, port, target,
+                                  *segmentSinks[i]);
+    }
+
+    // each connection serves segments idx, idx + N, ... The segment the sink
+    // is at streams into it so that playback starts with its first bytes,
+    // at most N - 1 segments ahead of it are kept in memory
+    for (std::size_t i = 0; i < nbSegments; ++i) {
+      const std::size_t idxClient = i % _clients.size();
+      segmentSinks[idxClient]->forwardTo(sink);
+      const RequestStats stats = segments[idxClient].get();
+
+      // the client checked the status and the first byte of the range
+      const std::uint64_t expectedSize = getSegmentSize(i);
+      if (stats._nbBytes != expectedSize) {
+        throw std::runtime_error("segment " + std::to_string(i) + " has " +
+                                 std::to_string(stats._nbBytes) +
+                                 " bytes instead of " +
+                                 std::to_string(expectedSize));
+      }
+
+      const std::size_t idxNext = i + _clients.size();
+      if (idxNext < nbSegments) {
+        segmentSinks[idxClient].reset(
+            new SegmentSink(getSegmentSize(idxNext)));
+        segments[idxClient] =
+            launchSegment(idxNext, offset, bodySize, host, port, target,
+                          *segmentSinks[idxClient]);
+      }
+    }
+  } catch (const std::exception &ex) {
+    LOG << "segmented download failed : " << ex.what();
+    sink.onEnd(std::current_exception());
+    // the other ranges are useless now, they end without retrying and no
+    // request must outlive the clients
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+      if (segments[i].valid()) {
+        _clients[i]->cancel();
+      }
+    }
+    for (std::future<RequestStats> &segment : segments) {
+      if (segment.valid()) {
+        segment.wait();
+      }
+    }
+    throw;
+  }
+
+  sink.onEnd(nullptr);
+  return nbBytes;
+}
+
+void benchmarkDownload(ssl::context &ctx, const std::string &host,
+                       const std::string &port, const std::string &target,
+                       const SegmentOptions &options, std::size_t nbIoThreads,
+                       std::ostream &os) {
+  typedef std::chrono::steady_clock Clock;
+  SegmentOptions baseline = options;
+  baseline._nbConnections = 1;
+  const std::vector<std::pair<SegmentOptions, std::size_t>> runs{
+      {baseline, 1}, {options, 1}, {options, nbIoThreads}};
+
+  for (const auto &run : runs) {
+    boost::asio::io_context ioService(static_cast<int>(run.second));
+    auto ioWork = boost::asio::make_work_guard(ioService);
+    std::vector<std::thread> ioThreads;
+    for (std::size_t i = 0; i < run.second; ++i) {
+      ioThreads.emplace_back([&ioService]() { ioService.run(); });
+    }
+
+    std::size_t nbBytes = 0;
+    std::chrono::milliseconds elapsed(0);
+    std::string error;
+    {
+      ConnectionPool pool;
+      SegmentedDownload download(ioService, ctx, pool, run.first);
+      NullSink sink;
+      const Clock::time_point start = Clock::now();
+      try {
+        nbBytes = download.run(host, port, target, sink);
+      } catch (const std::exception &ex) {
+        error = ex.what();
+      }
+      elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now() - start);
+      // pending shutdowns still use the clients
+      ioWork.reset();
+      for (std::thread &ioThread : ioThreads) {
+        ioThread.join();
+      }
+    }
+
+    os << run.first._nbConnections << " connections, " << run.second
+       << " io threads : ";
+    if (error.empty()) {
+      os << nbBytes << " bytes in " << elapsed.count() << " ms, "
+         << getKbPerSecond(nbBytes, elapsed) << " KB/s\n";
+    } else {
+      os << "failed, " << error << "\n";
+    }
+  }
+}
+
+}  // namespace Http
@@ -0,0 +1,81 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DOWNLOAD_HPP_
+#define DOWNLOAD_HPP_
+
+#include "Http.hpp"
+
+namespace Http {
+
+struct SegmentOptions {
+  SegmentOptions();
+
+  // 1 downloads on a single stream without any Range request
+  std::size_t _nbConnections;
+  std::size_t _segmentSize;
+};
+
+// downloads byte ranges of one body in parallel over several connections
+// and hands them to the sink in order, the first range as it arrives. Falls
+// back to a single stream when the server ignores Range requests
+class SegmentedDownload {
+  boost::asio::io_context &_ioService;
+  ssl::context &_sslCtx;
+  ConnectionPool &_pool;
+  SegmentOptions _options;
+  std::vector<std::unique_ptr<Client>> _clients;
+
+  std::size_t runSegments(const std::string &host, const std::string &port,
+                          const std::string &target, BodySink &sink,
+                          std::uint64_t offset);
+  std::size_t runSingleStream(const std::string &host, const std::string &port,
+                              const std::string &target, BodySink &sink,
+                              std::uint64_t offset);
+  // streams the range of segment idxSegment into segmentSink
+  std::future<RequestStats> launchSegment(
+      std::size_t idxSegment, std::uint64_t offset, std::uint64_t bodySize,
+      const std::string &host, const std::string &port,
+      const std::string &target, BodySink &segmentSink);
+
+ public:
+  SegmentedDownload(boost::asio::io_context &, ssl::context &,
+                    ConnectionPool &, SegmentOptions);
+  SegmentedDownload(const SegmentedDownload &) = delete;
+  SegmentedDownload(SegmentedDownload &&) = delete;
+
+  // blocks until the body from byte offset went to the sink, returns the
+  // number of bytes received. io_context must run on another thread.
+  // Throughput is logged to compare connection and io thread counts
+  std::size_t run(const std::string &host, const std::string &port,
+                  const std::string &target, BodySink &sink,
+                  std::uint64_t offset = 0);
+};
+
+// downloads the body with 1 io thread and 1 connection as the baseline, then
+// with the connections of options, then with nbIoThreads as well, and prints
+// the throughput of each run
+void benchmarkDownload(ssl::context &, const std::string &host,
+                       const std::string &port, const std::string &target,
+                       const SegmentOptions &options, std::size_t nbIoThreads,
+                       std::ostream &);
+
+}  // namespace Http
+
+#endif /* DOWNLOAD_HPP_ */
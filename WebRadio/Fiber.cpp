@@ -0,0 +1,55 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Fiber.hpp"
+
+#include <boost/fiber/future.hpp>
+
+namespace Http {
+namespace Fiber {
+
+Response get(Client &client, const std::string &host, const std::string &port,
+             const std::string &target) {
+  auto promise = std::make_shared<boost::fibers::promise<Response>>();
+  boost::fibers::future<Response> future = promise->get_future();
+  client.asyncGet(host, port, target, makePromiseHandler<Response>(promise));
+  return future.get();
+}
+
+Response head(Client &client, const std::string &host, const std::string &port,
+              const std::string &target) {
+  auto promise = std::make_shared<boost::fibers::promise<Response>>();
+  boost::fibers::future<Response> future = promise->get_future();
+  client.asyncHead(host, port, target, makePromiseHandler<Response>(promise));
+  return future.get();
+}
+
+RequestStats getStream(Client &client, const std::string &host,
+                       const std::string &port, const std::string &target,
+                       BodySink &sink, std::uint64_t offset,
+                       boost::optional<std::uint64_t> last) {
+  auto promise = std::make_shared<boost::fibers::promise<RequestStats>>();
+  boost::fibers::future<RequestStats> future = promise->get_future();
+  client.asyncGetStream(host, port, target, sink, offset, last,
+                        makePromiseHandler<RequestStats>(promise));
+  return future.get();
+}
+
+}  // namespace Fiber
+}  // namespace Http
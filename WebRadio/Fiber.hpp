@@ -0,0 +1,44 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FIBER_HPP_
+#define FIBER_HPP_
+
+#include "Http.hpp"
+
+namespace Http {
+
+// blocking calls that only suspend the calling fiber, the other fibers of
+// its thread keep running while the request is in flight. Errors, timeouts
+// and Client::cancel are thrown as boost::system::system_error
+namespace Fiber {
+
+Response get(Client &, const std::string &host, const std::string &port,
+             const std::string &target);
+Response head(Client &, const std::string &host, const std::string &port,
+              const std::string &target);
+RequestStats getStream(Client &, const std::string &host,
+                       const std::string &port, const std::string &target,
+                       BodySink &sink, std::uint64_t offset = 0,
+                       boost::optional<std::uint64_t> last = boost::none);
+
+}  // namespace Fiber
+}  // namespace Http
+
+#endif /* FIBER_HPP_ */
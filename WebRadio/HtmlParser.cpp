@@ -2,6 +2,7 @@
 
 #include <array>
 
+#include "Fiber.hpp"
 #include "JavascriptEngine.hpp"
 #include "Utils.hpp"
 
@@ -108,21 +109,36 @@ Http::Url extractVideoUrl(Http::Client& jsClient, const std::string& response) {
 
     LOG << "js path found : " << jsPath;
 
-    std::future<std::string> jsCodeFuture =
-        jsClient.get("s.ytimg.com", "443", jsPath + "?disable_polymer=true");
-
-    std::chrono::seconds span(10);
-    if (jsCodeFuture.wait_for(span) != std::future_status::ready) {
-      LOG << "signature decoding timeout ";
-      return Http::Url();
+    JSEngine::ProgramCache& programCache = JSEngine::getProgramCache();
+    JSEngine::DecipherProgram program = programCache.find(jsPath);
+    if (program.empty()) {
+      // a stalled request ends on the deadlines of the client, main bounds
+      // the whole request
+      Http::Response jsResponse;
+      try {
+        jsResponse = Http::Fiber::get(jsClient, "s.ytimg.com", "443",
+                                      jsPath + "?disable_polymer=true");
+      } catch (const std::exception& ex) {
+        LOG << "could not get js code : " << ex.what();
+        return Http::Url();
+      }
+      const std::string& jsCode = jsResponse._body;
+      LOG << "dump js code in js_code.txt";
+      Utils::saveFile("js_code.txt", jsCode,
+                      std::ofstream::out | std::ofstream::trunc);
+
+      program = JSEngine::extractProgram(jsCode);
+      if (program.empty()) {
+        LOG << "no decipher program in " << jsPath;
+        return Http::Url();
+      }
+      programCache.store(jsPath, program);
+    } else {
+      LOG << "decipher program of " << jsPath << " found in cache";
     }
-    const std::string& jsCode = jsCodeFuture.get();
-    LOG << "dump js code in js_code.txt";
-    Utils::saveFile("js_code.txt", jsCode,
-                    std::ofstream::out | std::ofstream::trunc);
 
     const std::string& decodedSig =
-        JSEngine::decipherSignature(jsCode, itSig->second);
+        JSEngine::decipherSignature(program, itSig->second);
     LOG << "decoded signature : " << decodedSig;
     urlStr += "&signature=" + decodedSig;
   }
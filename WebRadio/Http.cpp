@@ -19,16 +19,62 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Http.hpp"
 
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include "Connect.hpp"
+#include "Tls.hpp"
 #include "Utils.hpp"
 
 namespace Http {
 
 namespace {
 
+static const std::size_t streamChunkSize = 64 * 1024;
+static const std::size_t defaultMaxRetries = 4;
+static const std::chrono::milliseconds defaultRetryDelay(500);
+static const std::chrono::milliseconds maxRetryDelay(30000);
+
+static const std::chrono::milliseconds defaultResolveTimeout(5000);
+static const std::chrono::milliseconds defaultConnectTimeout(10000);
+static const std::chrono::milliseconds defaultHandshakeTimeout(10000);
+static const std::chrono::milliseconds defaultWriteTimeout(10000);
+static const std::chrono::milliseconds defaultFirstByteTimeout(15000);
+static const std::chrono::milliseconds defaultReadTimeout(30000);
+static const std::chrono::milliseconds defaultTotalTimeout(0);
+
 std::exception_ptr make_exception(boost::system::error_code err) {
   return std::make_exception_ptr(boost::system::system_error(err));
 }
 
+// Content-Range "bytes first-last/total" or "bytes */total", a part the
+// server did not send or sent as "*" stays empty
+struct ContentRange {
+  boost::optional<std::uint64_t> _first;
+  boost::optional<std::uint64_t> _total;
+};
+
+ContentRange parseContentRange(boost::string_view value) {
+  ContentRange range;
+  const std::string str = value.to_string();
+  const std::size_t posUnit = str.find("bytes ");
+  const std::size_t posSlash = str.find('/');
+  if (posUnit == std::string::npos || posSlash == std::string::npos) {
+    return range;
+  }
+  const std::size_t posFirst = posUnit + 6;
+  if (posFirst < str.size() && std::isdigit(str[posFirst])) {
+    range._first = std::strtoull(str.c_str() + posFirst, nullptr, 10);
+  }
+  if (posSlash + 1 < str.size() && std::isdigit(str[posSlash + 1])) {
+    range._total = std::strtoull(str.c_str() + posSlash + 1, nullptr, 10);
+  }
+  return range;
+}
+
 char hexToInt(char c) {
   // look ASCII table to get this
   return c <= '9' ? c - '0' : c - 'A' + 10;
@@ -50,15 +96,529 @@ std::string decode(std::string::const_iterator begin,
   return output;
 }
 
+//////////// REQUEST STATS //////////////////////////
+RequestStats::RequestStats()
+    : _start(),
+      _resolved(),
+      _connected(),
+      _handshaken(),
+      _requestWritten(),
+      _firstByte(),
+      _lastByte(),
+      _nbBytes(0),
+      _nbRetries(0),
+      _isReused(false) {}
+
+std::chrono::microseconds RequestStats::elapsed(Clock::time_point from,
+                                                Clock::time_point to) {
+  if (from == Clock::time_point() || to == Clock::time_point() || to < from) {
+    return std::chrono::microseconds(0);
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from);
+}
+
+std::ostream& operator<<(std::ostream& os, const RequestStats& stats) {
+  typedef RequestStats S;
+  // a reused connection sends its request right away
+  const S::Clock::time_point& ready =
+      stats._isReused ? stats._start : stats._handshaken;
+  return os << "resolve " << S::elapsed(stats._start, stats._resolved).count()
+            << " us, connect "
+            << S::elapsed(stats._resolved, stats._connected).count()
+            << " us, tls "
+            << S::elapsed(stats._connected, stats._handshaken).count()
+            << " us, request "
+            << S::elapsed(ready, stats._requestWritten).count()
+            << " us, first byte "
+            << S::elapsed(stats._requestWritten, stats._firstByte).count()
+            << " us, transfer "
+            << S::elapsed(stats._firstByte, stats._lastByte).count()
+            << " us, total "
+            << S::elapsed(stats._start, stats._lastByte).count() << " us, "
+            << stats._nbBytes << " bytes, " << stats._nbRetries << " retries"
+            << (stats._isReused ? ", reused connection" : "");
+}
+
+LatencyHistograms::LatencyHistograms()
+    : _resolve(),
+      _connect(),
+      _tls(),
+      _request(),
+      _firstByte(),
+      _transfer(),
+      _total() {}
+
+void LatencyHistograms::record(const RequestStats& stats) {
+  typedef RequestStats S;
+  if (!stats._isReused) {
+    _resolve.record(S::elapsed(stats._start, stats._resolved).count());
+    _connect.record(S::elapsed(stats._resolved, stats._connected).count());
+    _tls.record(S::elapsed(stats._connected, stats._handshaken).count());
+  }
+  const S::Clock::time_point& ready =
+      stats._isReused ? stats._start : stats._handshaken;
+  _request.record(S::elapsed(ready, stats._requestWritten).count());
+  _firstByte.record(
+      S::elapsed(stats._requestWritten, stats._firstByte).count());
+  _transfer.record(S::elapsed(stats._firstByte, stats._lastByte).count());
+  _total.record(S::elapsed(stats._start, stats._lastByte).count());
+}
+
+std::ostream& operator<<(std::ostream& os,
+                         const LatencyHistograms& histograms) {
+  return os << "request latencies in us :"
+            << "\n  resolve    " << histograms._resolve
+            << "\n  connect    " << histograms._connect
+            << "\n  tls        " << histograms._tls
+            << "\n  request    " << histograms._request
+            << "\n  first byte " << histograms._firstByte
+            << "\n  transfer   " << histograms._transfer
+            << "\n  total      " << histograms._total;
+}
+
+LatencyHistograms& getLatencyHistograms() {
+  static LatencyHistograms histograms;
+  return histograms;
+}
+
+Response::Response() : _body(), _stats(), _isFromCache(false) {}
+
+//////////// STREAM BUFFER //////////////////////////
+StreamBuffer::StreamBuffer()
+    : _mutex(),
+      _condition(),
+      _data(),
+      _expectedSize(),
+      _isComplete(false),
+      _error(),
+      _isAborted(false) {}
+
+void StreamBuffer::onHeader(boost::optional<std::uint64_t> contentLength) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _expectedSize = contentLength;
+  if (_expectedSize) {
+    _data.reserve(*_expectedSize);
+  }
+}
+
+void StreamBuffer::onData(const char* data, std::size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _data.append(data, size);
+  }
+  _condition.notify_all();
+}
+
+void StreamBuffer::onEnd(std::exception_ptr error) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _isComplete = true;
+    _error = error;
+  }
+  _condition.notify_all();
+}
+
+std::size_t StreamBuffer::read(std::size_t pos, char* output,
+                               std::size_t size) const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _condition.wait(lock, [this, pos]() {
+    return _isAborted || _isComplete || pos < _data.size();
+  });
+  if (_isAborted || pos >= _data.size()) {
+    return 0;
+  }
+  const std::size_t count = std::min(size, _data.size() - pos);
+  std::memcpy(output, _data.data() + pos, count);
+  return count;
+}
+
+std::exception_ptr StreamBuffer::getError() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _error;
+}
+
+void StreamBuffer::abort() const {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _isAborted = true;
+  }
+  _condition.notify_all();
+}
+
+boost::optional<std::uint64_t> StreamBuffer::getExpectedSize() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_isComplete) {
+    return boost::optional<std::uint64_t>(_data.size());
+  }
+  return _expectedSize;
+}
+
+const std::string& StreamBuffer::wait() const {
+  std::unique_lock<std::mutex> lock(_mutex);
+  _condition.wait(lock, [this]() { return _isComplete; });
+  // no more writer once complete
+  return _data;
+}
+
+bool StreamBuffer::isComplete() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _isComplete;
+}
+
+//////////// FILE SINK //////////////////////////
+std::string getResourceVersion(const http::response_header<>& header) {
+  const boost::string_view etag = header[http::field::etag];
+  const boost::string_view length = header[http::field::content_length];
+  if (etag.empty() && length.empty()) {
+    return std::string();
+  }
+  return etag.to_string() + " " + length.to_string();
+}
+
+FileSink::FileSink(std::string filePath, bool isResume,
+                   const std::string& version)
+    : _filePath(std::move(filePath)),
+      _partFilePath(_filePath + ".part"),
+      _metaFilePath(_partFilePath + ".meta"),
+      _resumeOffset(0),
+      _ofs() {
+  if (isResume && !version.empty()) {
+    std::string partVersion;
+    std::getline(std::ifstream(_metaFilePath), partVersion);
+    std::ifstream partFile(_partFilePath,
+                           std::ifstream::binary | std::ifstream::ate);
+    if (partFile && partVersion == version) {
+      _resumeOffset = static_cast<std::uint64_t>(partFile.tellg());
+      LOG << "resume " << _filePath << " after " << _resumeOffset << " bytes";
+    } else if (partFile) {
+      LOG << _partFilePath << " is from another version, start again";
+    }
+  }
+  // a partial file without its version is never resumed
+  if (version.empty()) {
+    std::remove(_metaFilePath.c_str());
+  } else {
+    std::ofstream(_metaFilePath, std::ofstream::trunc) << version << "\n";
+  }
+  _ofs.open(_partFilePath, std::ofstream::binary | std::ofstream::out |
+                               (_resumeOffset > 0 ? std::ofstream::app
+                                                  : std::ofstream::trunc));
+  if (!_ofs) {
+    LOG << "could not open " << _partFilePath;
+  }
+}
+
+std::uint64_t FileSink::getResumeOffset() const { return _resumeOffset; }
+
+void FileSink::onData(const char* data, std::size_t size) {
+  if (!_ofs.write(data, size)) {
+    LOG << "write failed on " << _filePath;
+  }
+}
+
+void FileSink::onEnd(std::exception_ptr error) {
+  _ofs.close();
+  if (error) {
+    LOG << _partFilePath << " kept for resume";
+  } else if (std::rename(_partFilePath.c_str(), _filePath.c_str()) != 0) {
+    LOG << "could not rename " << _partFilePath << " to " << _filePath;
+  } else {
+    std::remove(_metaFilePath.c_str());
+    LOG << _filePath << " saved";
+  }
+}
+
+//////////// TEE SINK //////////////////////////
+TeeSink::TeeSink() : _sinks() {}
+
+void TeeSink::add(BodySink& sink) { _sinks.push_back(&sink); }
+
+bool TeeSink::empty() const { return _sinks.empty(); }
+
+void TeeSink::onHeader(boost::optional<std::uint64_t> contentLength) {
+  for (BodySink* sink : _sinks) {
+    sink->onHeader(contentLength);
+  }
+}
+
+void TeeSink::onData(const char* data, std::size_t size) {
+  for (BodySink* sink : _sinks) {
+    sink->onData(data, size);
+  }
+}
+
+void TeeSink::onEnd(std::exception_ptr error) {
+  for (BodySink* sink : _sinks) {
+    sink->onEnd(error);
+  }
+}
+
+//////////// CONNECTION POOL //////////////////////////
+ConnectionPool::ConnectionPool(std::size_t maxIdlePerHost)
+    : _mutex(), _idle(), _maxIdlePerHost(maxIdlePerHost) {}
+
+std::unique_ptr<SslStream> ConnectionPool::acquire(const std::string& host,
+                                                   const std::string& port) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto it = _idle.find(host + ":" + port);
+  if (it == _idle.end()) {
+    return nullptr;
+  }
+  std::unique_ptr<SslStream> stream = std::move(it->second);
+  _idle.erase(it);
+  return stream;
+}
+
+void ConnectionPool::release(const std::string& host, const std::string& port,
+                             std::unique_ptr<SslStream> stream) {
+  const std::string key = host + ":" + port;
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_idle.count(key) < _maxIdlePerHost) {
+    _idle.emplace(key, std::move(stream));
+  }
+}
+
 //////////// HTTP CLIENT //////////////////////////
+Timeouts::Timeouts()
+    : _resolve(defaultResolveTimeout),
+      _connect(defaultConnectTimeout),
+      _handshake(defaultHandshakeTimeout),
+      _write(defaultWriteTimeout),
+      _firstByte(defaultFirstByteTimeout),
+      _read(defaultReadTimeout),
+      _total(defaultTotalTimeout) {}
+
 Client::Client(boost::asio::io_context& ioService, ssl::context& ctx)
     : _ioService(ioService),
-      _resolver(_ioService),
-      _stream(_ioService, ctx),
+      _sslCtx(ctx),
+      _strand(boost::asio::make_strand(ioService)),
+      _pool(nullptr),
+      _cache(nullptr),
+      _cachedEntry(),
+      _stream(),
+      _isReused(false),
+      _host(),
+      _port(),
       _buffer(),
       _request(),
-      _response(),
-      _promise() {}
+      _parser(),
+      _responseHandler(),
+      _stats(),
+      _streamParser(),
+      _chunk(),
+      _sink(nullptr),
+      _nbBytesStreamed(0),
+      _streamHandler(),
+      _streamOffset(0),
+      _streamLast(),
+      _isHeaderReceived(false),
+      _retryTimer(_strand),
+      _maxRetries(defaultMaxRetries),
+      _retryDelay(defaultRetryDelay),
+      _nbRetries(0),
+      _timeouts(),
+      _deadlineTimer(_strand),
+      _phase(Phase::idle),
+      _isTimedOut(false),
+      _abortReason(),
+      _totalTimer(_strand),
+      _racingConnect(),
+      _nbResolves(0) {}
+
+Client::Client(boost::asio::io_context& ioService, ssl::context& ctx,
+               ConnectionPool& pool)
+    : Client(ioService, ctx) {
+  _pool = &pool;
+}
+
+void Client::fail(boost::system::error_code err) {
+  endRequest();
+  // the handler may start the next request on this client
+  if (_sink != nullptr) {
+    _sink->onEnd(make_exception(err));
+    StreamHandler handler = std::move(_streamHandler);
+    handler(make_exception(err), _stats);
+  } else {
+    ResponseHandler handler = std::move(_responseHandler);
+    handler(make_exception(err), Response());
+  }
+}
+
+void Client::retryOrFail(boost::system::error_code err) {
+  const Phase failedPhase = _phase;
+  startPhase(Phase::idle);
+  if (_abortReason) {
+    fail(_abortReason);
+    return;
+  }
+  // cached endpoints that could not be reached are not tried again, nor
+  // saved for the next run
+  if (failedPhase == Phase::resolve || failedPhase == Phase::connect) {
+    getResolverCache().invalidate(_host, _port);
+  }
+  // the socket was closed under the pending operation
+  if (_isTimedOut) {
+    _isTimedOut = false;
+    err = boost::asio::error::timed_out;
+  }
+
+  // an idle connection may have been closed by the server in the meantime,
+  // nothing was received yet so start again on a new connection
+  if (_isReused && _nbBytesStreamed == 0) {
+    LOG << "reused connection to " << _host << " failed : " << err.message()
+        << ", reconnecting";
+    reconnect();
+    return;
+  }
+
+  if (_nbRetries >= _maxRetries) {
+    fail(err);
+    return;
+  }
+
+  const std::chrono::milliseconds delay =
+      std::min(maxRetryDelay, _retryDelay * (1 << _nbRetries));
+  ++_nbRetries;
+  _stats._nbRetries = _nbRetries;
+  LOG << "request to " << _host << " failed : " << err.message() << ", retry "
+      << _nbRetries << "/" << _maxRetries << " in " << delay.count()
+      << " ms after " << _nbBytesStreamed << " bytes";
+
+  _retryTimer.expires_after(delay);
+  _retryTimer.async_wait([this](boost::system::error_code errTimer) {
+    if (errTimer) {
+      this->fail(_abortReason ? _abortReason : errTimer);
+    } else {
+      this->reconnect();
+    }
+  });
+}
+
+void Client::reconnect() {
+  // a stream resumes after the bytes already handed to the sink
+  if (_sink != nullptr) {
+    const std::uint64_t position = _streamOffset + _nbBytesStreamed;
+    if (position > 0 || _streamLast) {
+      setRange(position, _streamLast);
+    } else {
+      clearRange();
+    }
+  }
+  resetParser();
+  connect();
+}
+
+void Client::recordStats() {
+  _stats._lastByte = RequestStats::Clock::now();
+  LOG << _host << _request.target() << " : " << _stats;
+  getLatencyHistograms().record(_stats);
+}
+
+void Client::startPhase(Phase phase) {
+  _phase = phase;
+  std::chrono::milliseconds timeout(0);
+  switch (phase) {
+    case Phase::idle:
+      break;
+    case Phase::resolve:
+      timeout = _timeouts._resolve;
+      break;
+    case Phase::connect:
+      timeout = _timeouts._connect;
+      break;
+    case Phase::handshake:
+      timeout = _timeouts._handshake;
+      break;
+    case Phase::write:
+      timeout = _timeouts._write;
+      break;
+    case Phase::firstByte:
+      timeout = _timeouts._firstByte;
+      break;
+    case Phase::read:
+      timeout = _timeouts._read;
+      break;
+  }
+  if (timeout.count() == 0) {
+    _deadlineTimer.cancel();
+    return;
+  }
+  _deadlineTimer.expires_after(timeout);
+  _deadlineTimer.async_wait([this, phase](boost::system::error_code err) {
+    if (!err) {
+      this->onDeadline(phase);
+    }
+  });
+}
+
+void Client::onDeadline(Phase phase) {
+  // expired just before being rearmed, the phase made progress in time
+  if (phase != _phase ||
+      _deadlineTimer.expiry() > boost::asio::steady_timer::clock_type::now()) {
+    return;
+  }
+  static const char* const phaseNames[] = {
+      "idle", "resolve", "connect", "handshake", "write", "first byte", "read",
+  };
+  LOG << phaseNames[static_cast<int>(phase)] << " timeout on " << _host
+      << _request.target();
+  _isTimedOut = true;
+  abort();
+}
+
+void Client::onTotalDeadline() {
+  // ended just before, or rearmed by the next request
+  if (_totalTimer.expiry() > boost::asio::steady_timer::clock_type::now()) {
+    return;
+  }
+  LOG << "total timeout on " << _host << _request.target() << " after "
+      << _stats._nbRetries << " retries";
+  _abortReason = boost::asio::error::timed_out;
+  _retryTimer.cancel();
+  abort();
+}
+
+void Client::endRequest() {
+  startPhase(Phase::idle);
+  _totalTimer.expires_at(boost::asio::steady_timer::time_point::max());
+}
+
+void Client::abort() {
+  switch (_phase) {
+    case Phase::idle:
+      break;
+    case Phase::resolve:
+      // drop the result of the pending resolve
+      ++_nbResolves;
+      retryOrFail(boost::asio::error::operation_aborted);
+      break;
+    case Phase::connect: {
+      // handler may replace _racingConnect
+      std::shared_ptr<RacingConnect> racingConnect = _racingConnect;
+      racingConnect->cancel();
+      break;
+    }
+    default: {
+      // pending operation completes with operation_aborted
+      boost::system::error_code errClose;
+      _stream->next_layer().close(errClose);
+      break;
+    }
+  }
+}
+
+void Client::finish(bool keepAlive) {
+  if (keepAlive && _pool != nullptr && _buffer.size() == 0) {
+    LOG << "keep connection to " << _host << " alive";
+    _pool->release(_host, _port, std::move(_stream));
+    return;
+  }
+  std::shared_ptr<SslStream> stream(std::move(_stream));
+  stream->async_shutdown(
+      onStrand([this, stream](boost::system::error_code errShutdown) {
+        this->onShutdown(errShutdown);
+      }));
+}
 
 void Client::onShutdown(boost::system::error_code err) {
   if (err == boost::asio::error::eof) {
@@ -71,85 +631,313 @@ void Client::onShutdown(boost::system::error_code err) {
   }
 }
 
+void Client::readChunk() {
+  startPhase(Phase::read);
+  http::buffer_body::value_type& body = _streamParser->get().body();
+  body.data = _chunk.data();
+  body.size = _chunk.size();
+  http::async_read(*_stream, _buffer, *_streamParser,
+                   onStrand([this](boost::system::error_code errRead,
+                                   std::size_t nbBytesRead) {
+                     this->onReadChunk(errRead, nbBytesRead);
+                   }));
+}
+
+void Client::onReadChunk(boost::system::error_code err, std::size_t nbBytes) {
+  // chunk buffer is full, not an error
+  if (err == http::error::need_buffer) {
+    err.assign(0, err.category());
+  }
+  if (err) {
+    LOG << "onReadChunk error : " << err.message() << " after "
+        << _nbBytesStreamed << " bytes";
+    retryOrFail(err);
+    return;
+  }
+
+  const char* data = _chunk.data();
+  const std::size_t size = _chunk.size() - _streamParser->get().body().size;
+  if (size > 0) {
+    _nbBytesStreamed += size;
+    _sink->onData(data, size);
+  }
+
+  if (_streamParser->is_done()) {
+    LOG << "stream read success : " << _nbBytesStreamed;
+    _stats._nbBytes = _nbBytesStreamed;
+    endRequest();
+    recordStats();
+    _sink->onEnd(nullptr);
+    // the client may be reused as soon as the handler is called
+    finish(_streamParser->keep_alive());
+    StreamHandler handler = std::move(_streamHandler);
+    handler(nullptr, _stats);
+  } else {
+    readChunk();
+  }
+}
+
+void Client::onReadHeader(boost::system::error_code err, std::size_t nbBytes) {
+  if (err) {
+    LOG << "onReadHeader error : " << err.message();
+    retryOrFail(err);
+    return;
+  }
+  _stats._firstByte = RequestStats::Clock::now();
+
+  if (_sink == nullptr) {
+    LOG << "header read success, status " << _parser->get().result_int();
+    startPhase(Phase::read);
+    http::async_read(*_stream, _buffer, *_parser,
+                     onStrand([this](auto errRead, auto nbBytesRead) {
+                       this->onRead(errRead, nbBytesRead);
+                     }));
+    return;
+  }
+
+  const unsigned status = _streamParser->get().result_int();
+  const std::uint64_t position = _streamOffset + _nbBytesStreamed;
+  LOG << "header read success, status " << status << " at byte " << position;
+  const ContentRange range =
+      parseContentRange(_streamParser->get()[http::field::content_range]);
+
+  // resumed exactly at the end of the body, nothing is missing
+  if (position > 0 && status == 416 && range._total &&
+      *range._total == position) {
+    LOG << "nothing left to read after byte " << position;
+    _stats._nbBytes = _nbBytesStreamed;
+    endRequest();
+    recordStats();
+    if (!_isHeaderReceived) {
+      _isHeaderReceived = true;
+      _sink->onHeader(std::uint64_t(0));
+    }
+    _sink->onEnd(nullptr);
+    // the error body is left unread
+    finish(false);
+    StreamHandler handler = std::move(_streamHandler);
+    handler(nullptr, _stats);
+    return;
+  }
+
+  // the sink must get the body from position on and nothing else
+  const bool isRange = position > 0 || _streamLast;
+  const bool isExpected =
+      isRange ? status == 206 && range._first && *range._first == position
+              : status == 200;
+  if (!isExpected) {
+    LOG << "unexpected status " << status << " for byte " << position
+        << " of " << _host << _request.target();
+    finish(false);
+    const boost::system::error_code errStatus =
+        boost::system::errc::make_error_code(
+            boost::system::errc::protocol_error);
+    // server side errors may be transient
+    if (status >= 500) {
+      retryOrFail(errStatus);
+    } else {
+      fail(errStatus);
+    }
+    return;
+  }
+
+  if (!_isHeaderReceived) {
+    _isHeaderReceived = true;
+    _sink->onHeader(_streamParser->content_length());
+  }
+  readChunk();
+}
+
 void Client::onRead(boost::system::error_code err, std::size_t nbBytes) {
   if (err) {
     LOG << "onRead error : " << err.message();
-    _promise.set_exception(make_exception(err));
-  } else {
-    LOG << " read success : " << nbBytes; /*<< _response*/
-    ;
+    retryOrFail(err);
+    return;
+  }
+  LOG << " read success : " << nbBytes;
 
-    //    this->processResponse(_response.body());
-    _promise.set_value(std::move(_response.body()));
-    _stream.async_shutdown([this](boost::system::error_code errShutdown) {
-      this->onShutdown(errShutdown);
-    });
+  const http::response<DecodedBody>& message = _parser->get();
+  const std::string target = _request.target().to_string();
+  Response response;
+  if (_cachedEntry && message.result() == http::status::not_modified) {
+    if (!_cache->readBody(*_cachedEntry, response._body)) {
+      // ask again without validators
+      _cache->erase(_host, target);
+      finish(_parser->keep_alive());
+      const std::string host = _host;
+      const std::string port = _port;
+      launch(_request.method(), host, port, target);
+      return;
+    }
+    LOG << _host << target << " not modified, served from cache";
+    response._isFromCache = true;
+  } else {
+    response._body = std::move(_parser->get().body());
+    if (_cache != nullptr && message.result() == http::status::ok &&
+        _request.method() == http::verb::get &&
+        _request.find(http::field::range) == _request.end()) {
+      _cache->store(_host, target, message[http::field::etag].to_string(),
+                    message[http::field::last_modified].to_string(),
+                    message[http::field::cache_control].to_string(),
+                    response._body);
+    }
   }
+  _stats._nbBytes = response._body.size();
+  endRequest();
+  recordStats();
+  response._stats = _stats;
+  // the client may be reused as soon as the handler is called
+  finish(_parser->keep_alive());
+  ResponseHandler handler = std::move(_responseHandler);
+  handler(nullptr, std::move(response));
 }
 
 void Client::onWrite(boost::system::error_code err, std::size_t nbBytes) {
   if (err) {
     LOG << "onWrite error : " << err.message();
-    _promise.set_exception(make_exception(err));
+    retryOrFail(err);
+    return;
+  }
+  _stats._requestWritten = RequestStats::Clock::now();
+  startPhase(Phase::firstByte);
+  auto onHeader = onStrand([this](auto errRead, auto nbBytesRead) {
+    this->onReadHeader(errRead, nbBytesRead);
+  });
+  if (_sink != nullptr) {
+    LOG << "write success, streaming body";
+    http::async_read_header(*_stream, _buffer, *_streamParser, onHeader);
   } else {
     LOG << "write success";
-    http::async_read(_stream, _buffer, _response,
-                     [this](auto errRead, auto nbBytesRead) {
-                       this->onRead(errRead, nbBytesRead);
-                     });
+    http::async_read_header(*_stream, _buffer, *_parser, onHeader);
   }
 }
 
+void Client::sendRequest() {
+  startPhase(Phase::write);
+  http::async_write(
+      *_stream, _request,
+      onStrand([this](boost::system::error_code errWrite, std::size_t nbBytes) {
+        this->onWrite(errWrite, nbBytes);
+      }));
+}
+
 void Client::onHandshake(boost::system::error_code err) {
   if (err) {
     LOG << "onHandshake err : " << err.message();
-    _promise.set_exception(make_exception(err));
+    retryOrFail(err);
   } else {
-    LOG << "handshake success ";
-    http::async_write(
-        _stream, _request,
-        [this](boost::system::error_code errWrite, std::size_t nbBytes) {
-          this->onWrite(errWrite, nbBytes);
-        });
+    _stats._handshaken = RequestStats::Clock::now();
+    ::SSL* ssl = _stream->native_handle();
+    LOG << "handshake success, session "
+        << (::SSL_session_reused(ssl) ? "resumed" : "new");
+    if (TlsSessionCache* cache = TlsSessionCache::find(ssl)) {
+      cache->onHandshake(ssl);
+    }
+    sendRequest();
   }
 }
 
 void Client::onConnect(boost::system::error_code err,
-                       tcp::resolver::iterator itResolver) {
+                       const tcp::endpoint& endpoint) {
   if (err) {
     LOG << "onConnect err : " << err.message();
-    _promise.set_exception(make_exception(err));
+    retryOrFail(err);
   } else {
-    LOG << " connect success ";
-    _stream.async_handshake(ssl::stream_base::client,
-                            [this](boost::system::error_code errHandshake) {
-                              this->onHandshake(errHandshake);
-                            });
+    _stats._connected = RequestStats::Clock::now();
+    LOG << " connect success to " << endpoint;
+    startPhase(Phase::handshake);
+    _stream->async_handshake(
+        ssl::stream_base::client,
+        onStrand([this](boost::system::error_code errHandshake) {
+          this->onHandshake(errHandshake);
+        }));
   }
 }
 
 void Client::onResolve(boost::system::error_code err,
-                       tcp::resolver::iterator endpoint) {
+                       const Endpoints& endpoints) {
+  if (!err && endpoints.empty()) {
+    err = boost::asio::error::host_not_found;
+  }
   if (err) {
     LOG << "onResolve err : " << err.message();
-    _promise.set_exception(make_exception(err));
+    retryOrFail(err);
   } else {
-    LOG << "onResolve success ";
-    boost::asio::async_connect(_stream.next_layer(), endpoint,
-                               [this](boost::system::error_code errConnect,
-                                      tcp::resolver::iterator itResolver) {
-                                 this->onConnect(errConnect, itResolver);
-                               });
+    _stats._resolved = RequestStats::Clock::now();
+    LOG << "onResolve success, " << endpoints.size() << " endpoints";
+    startPhase(Phase::connect);
+    _racingConnect = RacingConnect::start(
+        _strand, _host, endpoints,
+        [this](boost::system::error_code errConnect, tcp::socket socket,
+               const tcp::endpoint& endpoint) {
+          _racingConnect.reset();
+          if (!errConnect) {
+            _stream->next_layer() = std::move(socket);
+          }
+          this->onConnect(errConnect, endpoint);
+        });
+  }
+}
+
+void Client::setRange(std::uint64_t first,
+                      boost::optional<std::uint64_t> last) {
+  std::string range = "bytes=" + std::to_string(first) + "-";
+  if (last) {
+    range += std::to_string(*last);
   }
+  _request.set(http::field::range, range);
 }
 
+void Client::clearRange() { _request.erase(http::field::range); }
+
+// the request is owned by the strand, the change is posted before the next
+// request so that it cannot race with the end of the previous one
 void Client::setRequestCookies(std::string cookies) {
-  LOG << "request cookie set to : " << cookies;
-  _request.set(http::field::cookie, std::move(cookies));
+  boost::asio::post(_strand, [this, cookies]() {
+    LOG << "request cookie set to : " << cookies;
+    _request.set(http::field::cookie, cookies);
+  });
+}
+
+void Client::setRequestRange(std::uint64_t first,
+                             boost::optional<std::uint64_t> last) {
+  boost::asio::post(_strand,
+                    [this, first, last]() { this->setRange(first, last); });
+}
+
+void Client::clearRequestRange() {
+  boost::asio::post(_strand, [this]() { this->clearRange(); });
+}
+
+void Client::setResponseCache(ResponseCache& cache) {
+  boost::asio::post(_strand, [this, &cache]() { _cache = &cache; });
+}
+
+void Client::setRetryPolicy(std::size_t maxRetries,
+                            std::chrono::milliseconds firstDelay) {
+  boost::asio::post(_strand, [this, maxRetries, firstDelay]() {
+    _maxRetries = maxRetries;
+    _retryDelay = firstDelay;
+  });
+}
+
+void Client::setTimeouts(const Timeouts& timeouts) {
+  boost::asio::post(_strand, [this, timeouts]() { _timeouts = timeouts; });
+}
+
+void Client::cancel() {
+  // every member is owned by the strand
+  boost::asio::post(_strand, [this]() {
+    LOG << "cancel request to " << _host << _request.target();
+    _abortReason = boost::asio::error::operation_aborted;
+    _retryTimer.cancel();
+    this->abort();
+  });
 }
 
 std::string Client::getResponseCookies() const {
-  auto rangeCookies = _response.equal_range(http::field::set_cookie);
+  auto rangeCookies =
+      getResponseHeader().equal_range(http::field::set_cookie);
   std::string cookies;
   cookies.reserve(512);
   for (auto itCookies = rangeCookies.first; itCookies != rangeCookies.second;
@@ -165,24 +953,217 @@ std::string Client::getResponseCookies() const {
   return cookies;
 }
 
-std::future<std::string> Client::get(const std::string& host,
-                                     const std::string& port,
-                                     const std::string& target) {
+const http::response_header<>& Client::getResponseHeader() const {
+  if (_sink != nullptr) {
+    return _streamParser->get();
+  }
+  return _parser->get();
+}
+
+void Client::resetParser() {
+  _buffer.consume(_buffer.size());
+  // body limits are lifted, default is 8MB which is too small for a video
+  if (_sink != nullptr) {
+    _streamParser.emplace();
+    _streamParser->body_limit(std::numeric_limits<std::uint64_t>::max());
+  } else {
+    _parser.emplace();
+    _parser->body_limit(std::numeric_limits<std::uint64_t>::max());
+    // a HEAD response announces a body that is never sent
+    _parser->skip(_request.method() == http::verb::head);
+  }
+}
+
+bool Client::serveFromCache(const ResponseCache::Entry& entry) {
+  const std::string target = _request.target().to_string();
+  Response response;
+  if (!_cache->readBody(entry, response._body)) {
+    _cache->erase(_host, target);
+    return false;
+  }
+  LOG << _host << target << " served from cache";
+  endRequest();
+  response._isFromCache = true;
+  _stats._nbBytes = response._body.size();
+  response._stats = _stats;
+  ResponseHandler handler = std::move(_responseHandler);
+  handler(nullptr, std::move(response));
+  return true;
+}
+
+void Client::connect() {
+  _isReused = false;
+  _stats._isReused = false;
+  _stream.reset(new SslStream(_strand, _sslCtx));
+  TlsSessionCache::prepare(_stream->native_handle(), _host);
+
+  LOG << "Launch resolve on " << _host << _request.target();
+
+  const std::size_t idxResolve = ++_nbResolves;
+  startPhase(Phase::resolve);
+  getResolverCache().resolve(
+      _ioService, _host, _port,
+      [this, idxResolve](boost::system::error_code ec,
+                         const Endpoints& endpoints) {
+        boost::asio::post(_strand, [this, idxResolve, ec, endpoints]() {
+          if (idxResolve == _nbResolves) {
+            this->onResolve(ec, endpoints);
+          }
+        });
+      });
+}
+
+void Client::launch(http::verb method, const std::string& host,
+                    const std::string& port, const std::string& target) {
+  _host = host;
+  _port = port;
   _request.version(11);
-  _request.method(http::verb::get);
+  _request.method(method);
   _request.target(target);
+  _request.keep_alive(_pool != nullptr);
   _request.set(http::field::host, host);
   _request.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+  // a range or a HEAD content length must match the raw bytes
+  const bool isWholeBody = method == http::verb::get && _sink == nullptr &&
+                           _request.find(http::field::range) == _request.end();
+  if (isWholeBody) {
+    _request.set(http::field::accept_encoding, acceptedEncodings);
+  } else {
+    _request.erase(http::field::accept_encoding);
+  }
+  _request.erase(http::field::if_none_match);
+  _request.erase(http::field::if_modified_since);
+  _cachedEntry.reset();
+  _nbRetries = 0;
+  _isTimedOut = false;
+  _abortReason = boost::system::error_code();
+  _stats = RequestStats();
+  _stats._start = RequestStats::Clock::now();
+  resetParser();
+  if (_timeouts._total.count() > 0) {
+    _totalTimer.expires_after(_timeouts._total);
+    _totalTimer.async_wait([this](boost::system::error_code err) {
+      if (!err) {
+        this->onTotalDeadline();
+      }
+    });
+  } else {
+    _totalTimer.expires_at(boost::asio::steady_timer::time_point::max());
+  }
 
-  LOG << "Launch resolve on " << host << target;
+  ResponseCache::Entry entry;
+  switch (_cache != nullptr && isWholeBody ? _cache->find(host, target, entry)
+                                           : ResponseCache::Lookup::miss) {
+    case ResponseCache::Lookup::fresh:
+      if (serveFromCache(entry)) {
+        return;
+      }
+      break;
+    case ResponseCache::Lookup::stale:
+      if (!entry._etag.empty()) {
+        _request.set(http::field::if_none_match, entry._etag);
+      }
+      if (!entry._lastModified.empty()) {
+        _request.set(http::field::if_modified_since, entry._lastModified);
+      }
+      _cachedEntry = std::move(entry);
+      break;
+    case ResponseCache::Lookup::miss:
+      break;
+  }
 
-  _resolver.async_resolve(
-      {host, port},
-      [this](boost::system::error_code ec, tcp::resolver::iterator resolverIt) {
-        this->onResolve(ec, resolverIt);
-      });
+  if (_pool != nullptr) {
+    _stream = _pool->acquire(host, port);
+  }
+  if (_stream) {
+    LOG << "Reuse connection to " << host << " for " << target;
+    _isReused = true;
+    _stats._isReused = true;
+    sendRequest();
+  } else {
+    connect();
+  }
+}
+
+void Client::asyncGet(const std::string& host, const std::string& port,
+                      const std::string& target, ResponseHandler handler) {
+  // the previous request may still be ending on the strand
+  boost::asio::post(_strand, [this, host, port, target,
+                              handler = std::move(handler)]() mutable {
+    _sink = nullptr;
+    // bytes of a previous stream would keep a reused connection that failed
+    // from reconnecting
+    _nbBytesStreamed = 0;
+    _streamOffset = 0;
+    _streamLast = boost::none;
+    _responseHandler = std::move(handler);
+    this->launch(http::verb::get, host, port, target);
+  });
+}
+
+void Client::asyncHead(const std::string& host, const std::string& port,
+                       const std::string& target, ResponseHandler handler) {
+  boost::asio::post(_strand, [this, host, port, target,
+                              handler = std::move(handler)]() mutable {
+    _sink = nullptr;
+    _nbBytesStreamed = 0;
+    _streamOffset = 0;
+    _streamLast = boost::none;
+    _responseHandler = std::move(handler);
+    this->launch(http::verb::head, host, port, target);
+  });
+}
+
+void Client::asyncGetStream(const std::string& host, const std::string& port,
+                            const std::string& target, BodySink& sink,
+                            std::uint64_t offset,
+                            boost::optional<std::uint64_t> last,
+                            StreamHandler handler) {
+  boost::asio::post(_strand, [this, host, port, target, &sink, offset, last,
+                              handler = std::move(handler)]() mutable {
+    _sink = &sink;
+    _nbBytesStreamed = 0;
+    _streamOffset = offset;
+    _streamLast = last;
+    _isHeaderReceived = false;
+    if (offset > 0 || last) {
+      setRange(offset, last);
+    } else {
+      clearRange();
+    }
+    _chunk.resize(streamChunkSize);
+    _streamHandler = std::move(handler);
+    this->launch(http::verb::get, host, port, target);
+  });
+}
+
+std::future<Response> Client::get(const std::string& host,
+                                  const std::string& port,
+                                  const std::string& target) {
+  auto promise = std::make_shared<std::promise<Response>>();
+  std::future<Response> future = promise->get_future();
+  asyncGet(host, port, target, makePromiseHandler<Response>(promise));
+  return future;
+}
+
+std::future<Response> Client::head(const std::string& host,
+                                   const std::string& port,
+                                   const std::string& target) {
+  auto promise = std::make_shared<std::promise<Response>>();
+  std::future<Response> future = promise->get_future();
+  asyncHead(host, port, target, makePromiseHandler<Response>(promise));
+  return future;
+}
 
-  return _promise.get_future();
+std::future<RequestStats> Client::getStream(
+    const std::string& host, const std::string& port,
+    const std::string& target, BodySink& sink, std::uint64_t offset,
+    boost::optional<std::uint64_t> last) {
+  auto promise = std::make_shared<std::promise<RequestStats>>();
+  std::future<RequestStats> future = promise->get_future();
+  asyncGetStream(host, port, target, sink, offset, last,
+                 makePromiseHandler<RequestStats>(promise));
+  return future;
 }
 
 ////////////// HTTP URL ///////////////////
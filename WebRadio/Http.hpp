@@ -20,50 +20,402 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef HTTP_HPP_
 #define HTTP_HPP_
 
+#include <boost/asio/bind_executor.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/optional.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
 #include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Cache.hpp"
+#include "Compression.hpp"
+#include "Connect.hpp"
+#include "Utils.hpp"
 
 namespace Http {
 namespace ssl = boost::asio::ssl;
 using tcp = boost::asio::ip::tcp;
 namespace http = boost::beast::http;
 
+// timestamps of each phase of one request, phases that did not happen (e.g.
+// connect on a reused connection) keep a default time_point
+struct RequestStats {
+  typedef std::chrono::steady_clock Clock;
+
+  RequestStats();
+
+  // duration between two phases, 0 if one of them did not happen
+  static std::chrono::microseconds elapsed(Clock::time_point from,
+                                           Clock::time_point to);
+
+  Clock::time_point _start;
+  Clock::time_point _resolved;
+  Clock::time_point _connected;
+  Clock::time_point _handshaken;
+  Clock::time_point _requestWritten;
+  Clock::time_point _firstByte;
+  Clock::time_point _lastByte;
+  std::uint64_t _nbBytes;
+  std::size_t _nbRetries;
+  bool _isReused;
+};
+
+std::ostream &operator<<(std::ostream &, const RequestStats &);
+
+// per phase latency of every request of the process, in microseconds
+class LatencyHistograms {
+  Utils::Histogram _resolve;
+  Utils::Histogram _connect;
+  Utils::Histogram _tls;
+  Utils::Histogram _request;
+  Utils::Histogram _firstByte;
+  Utils::Histogram _transfer;
+  Utils::Histogram _total;
+
+  friend std::ostream &operator<<(std::ostream &, const LatencyHistograms &);
+
+ public:
+  LatencyHistograms();
+  LatencyHistograms(const LatencyHistograms &) = delete;
+  LatencyHistograms(LatencyHistograms &&) = delete;
+
+  void record(const RequestStats &);
+};
+
+std::ostream &operator<<(std::ostream &, const LatencyHistograms &);
+
+LatencyHistograms &getLatencyHistograms();
+
+struct Response {
+  Response();
+
+  std::string _body;
+  RequestStats _stats;
+  // served by the ResponseCache, after a 304 or without any request
+  bool _isFromCache;
+};
+
+// receives a response body piece by piece, called from one thread at a time
+class BodySink {
+ public:
+  virtual ~BodySink() = default;
+
+  // contentLength is empty when the server does not send it
+  virtual void onHeader(boost::optional<std::uint64_t> contentLength) {}
+  virtual void onData(const char *data, std::size_t size) = 0;
+  // error is null when the whole body has been received
+  virtual void onEnd(std::exception_ptr error) {}
+};
+
+// growing in memory body : filled by the io thread while a consumer reads it,
+// the consumer only waits when it gets ahead of the network
+class StreamBuffer : public BodySink {
+  mutable std::mutex _mutex;
+  mutable std::condition_variable _condition;
+  std::string _data;
+  boost::optional<std::uint64_t> _expectedSize;
+  bool _isComplete;
+  std::exception_ptr _error;
+  // set by the reader, which only holds a const reference
+  mutable bool _isAborted;
+
+ public:
+  StreamBuffer();
+  StreamBuffer(const StreamBuffer &) = delete;
+  StreamBuffer(StreamBuffer &&) = delete;
+
+  void onHeader(boost::optional<std::uint64_t> contentLength) override;
+  void onData(const char *data, std::size_t size) override;
+  void onEnd(std::exception_ptr error) override;
+
+  // copies up to size bytes starting at pos, waits until they are received
+  // returns 0 once pos reaches the end of the body, see getError
+  std::size_t read(std::size_t pos, char *output, std::size_t size) const;
+  // error the body ended with, null while it is received or once complete
+  std::exception_ptr getError() const;
+  // wakes up a waiting read for good, reads return 0 from then on while the
+  // body keeps being received. For a reader that stops before the end
+  void abort() const;
+
+  // total size if known from the headers or once the body is complete
+  boost::optional<std::uint64_t> getExpectedSize() const;
+
+  // waits for the end of the body and returns it
+  const std::string &wait() const;
+  bool isComplete() const;
+};
+
+// identifies one version of a resource by its ETag and Content-Length, empty
+// when the header has neither
+std::string getResourceVersion(const http::response_header<> &);
+
+// writes the body to disk chunk by chunk, memory use does not depend on the
+// body size. Data goes to filePath.part which is renamed once complete and
+// kept on error so that a later run can resume from it. The resource version
+// is kept in filePath.part.meta, a partial file of another version is
+// downloaded again from the start
+class FileSink : public BodySink {
+  std::string _filePath;
+  std::string _partFilePath;
+  std::string _metaFilePath;
+  std::uint64_t _resumeOffset;
+  std::ofstream _ofs;
+
+ public:
+  // isResume appends to an existing partial file of the same version instead
+  // of truncating it, an empty version never resumes
+  FileSink(std::string filePath, bool isResume = false,
+           const std::string &version = std::string());
+  FileSink(const FileSink &) = delete;
+  FileSink(FileSink &&) = delete;
+
+  // bytes already in the partial file, the body must continue from there
+  std::uint64_t getResumeOffset() const;
+
+  void onData(const char *data, std::size_t size) override;
+  void onEnd(std::exception_ptr error) override;
+};
+
+// forwards the body to several sinks, e.g. play and save at the same time
+class TeeSink : public BodySink {
+  std::vector<BodySink *> _sinks;
+
+ public:
+  TeeSink();
+
+  void add(BodySink &sink);
+  bool empty() const;
+
+  void onHeader(boost::optional<std::uint64_t> contentLength) override;
+  void onData(const char *data, std::size_t size) override;
+  void onEnd(std::exception_ptr error) override;
+};
+
+typedef ssl::stream<tcp::socket> SslStream;
+
+// deadline of each phase of a request, a phase that misses it has its socket
+// closed and the request is retried as if the connection dropped. The total
+// deadline bounds the whole request, retries and their delays included, and
+// ends it with timed_out. Zero disables a deadline
+struct Timeouts {
+  Timeouts();
+
+  std::chrono::milliseconds _resolve;
+  std::chrono::milliseconds _connect;
+  std::chrono::milliseconds _handshake;
+  std::chrono::milliseconds _write;
+  // from request written to response header
+  std::chrono::milliseconds _firstByte;
+  // whole body of get(), each chunk of getStream()
+  std::chrono::milliseconds _read;
+  // none by default, a download takes as long as the body needs
+  std::chrono::milliseconds _total;
+};
+
+// idle keep-alive connections keyed by host:port, shared between clients so
+// that a request to a known host skips resolve, connect and TLS handshake
+class ConnectionPool {
+  std::mutex _mutex;
+  std::multimap<std::string, std::unique_ptr<SslStream>> _idle;
+  std::size_t _maxIdlePerHost;
+
+ public:
+  ConnectionPool(std::size_t maxIdlePerHost = 4);
+  ConnectionPool(const ConnectionPool &) = delete;
+  ConnectionPool(ConnectionPool &&) = delete;
+
+  // nullptr when no idle connection to this host is available
+  std::unique_ptr<SslStream> acquire(const std::string &host,
+                                     const std::string &port);
+  void release(const std::string &host, const std::string &port,
+               std::unique_ptr<SslStream> stream);
+};
+
+// one request in flight at a time, a new future is returned for each request.
+// Handlers of a client run on its own strand so that several clients can be
+// served by several io threads. get() asks for a compressed body unless a
+// range is set, head() and getStream() always get the raw bytes
 class Client {
+ public:
+  // called once from the strand of the client, with an error or a result
+  typedef std::function<void(std::exception_ptr, Response)> ResponseHandler;
+  typedef std::function<void(std::exception_ptr, RequestStats)> StreamHandler;
+
+ private:
+  enum class Phase {
+    idle,
+    resolve,
+    connect,
+    handshake,
+    write,
+    firstByte,
+    read,
+  };
+
   boost::asio::io_context &_ioService;
-  tcp::resolver _resolver;
-  ssl::stream<tcp::socket> _stream;
+  ssl::context &_sslCtx;
+  Strand _strand;
+  ConnectionPool *_pool;
+  ResponseCache *_cache;
+  // stale entry of the request in flight, sent for revalidation
+  boost::optional<ResponseCache::Entry> _cachedEntry;
+  std::unique_ptr<SslStream> _stream;
+  bool _isReused;
+  std::string _host;
+  std::string _port;
   boost::beast::flat_buffer _buffer;
   http::request<http::string_body> _request;
-  http::response<http::string_body> _response;
-  std::promise<std::string> _promise;
+  // compressed bodies are decoded as they arrive
+  boost::optional<http::response_parser<DecodedBody>> _parser;
+  ResponseHandler _responseHandler;
+  RequestStats _stats;
+
+  // streaming mode, body goes to _sink instead of _parser
+  boost::optional<http::response_parser<http::buffer_body>> _streamParser;
+  std::vector<char> _chunk;
+  BodySink *_sink;
+  std::size_t _nbBytesStreamed;
+  StreamHandler _streamHandler;
+  std::uint64_t _streamOffset;
+  // last byte of a ranged stream, empty up to the end of the body
+  boost::optional<std::uint64_t> _streamLast;
+  bool _isHeaderReceived;
+
+  // failed requests are retried, streams resume where they stopped
+  boost::asio::steady_timer _retryTimer;
+  std::size_t _maxRetries;
+  std::chrono::milliseconds _retryDelay;
+  std::size_t _nbRetries;
+
+  // pending phase is aborted by closing its socket when its deadline expires
+  Timeouts _timeouts;
+  boost::asio::steady_timer _deadlineTimer;
+  Phase _phase;
+  bool _isTimedOut;
+  // ends the request at its next step without any retry
+  boost::system::error_code _abortReason;
+  boost::asio::steady_timer _totalTimer;
+  std::shared_ptr<RacingConnect> _racingConnect;
+  // a resolve cannot be aborted, its late result is ignored
+  std::size_t _nbResolves;
+
+  // a pooled connection may come from another client, its handlers are
+  // bound to this strand explicitly
+  template <typename Handler>
+  boost::asio::executor_binder<Handler, Strand> onStrand(Handler handler) {
+    return boost::asio::bind_executor(_strand, std::move(handler));
+  }
+
+  void setRange(std::uint64_t first, boost::optional<std::uint64_t> last);
+  void clearRange();
+  void launch(http::verb method, const std::string &host,
+              const std::string &port, const std::string &target);
+  void resetParser();
+  // false if the cache lost its body
+  bool serveFromCache(const ResponseCache::Entry &);
+  void connect();
+  void reconnect();
+  void sendRequest();
+  void retryOrFail(boost::system::error_code);
+  void fail(boost::system::error_code);
+  void readChunk();
+  void finish(bool keepAlive);
+  void recordStats();
+  void startPhase(Phase);
+  void onDeadline(Phase);
+  void onTotalDeadline();
+  void abort();
+  // the request succeeded or failed, no deadline applies anymore
+  void endRequest();
 
   void onShutdown(boost::system::error_code);
+  void onReadChunk(boost::system::error_code, size_t);
+  void onReadHeader(boost::system::error_code, size_t);
   void onRead(boost::system::error_code, size_t);
   void onWrite(boost::system::error_code, size_t);
   void onHandshake(boost::system::error_code);
-  void onConnect(boost::system::error_code, tcp::resolver::iterator);
-  void onResolve(boost::system::error_code, tcp::resolver::iterator);
+  void onConnect(boost::system::error_code, const tcp::endpoint &);
+  void onResolve(boost::system::error_code, const Endpoints &);
 
  public:
   Client(boost::asio::io_context &, ssl::context &);
+  // reuses keep-alive connections from the pool
+  Client(boost::asio::io_context &, ssl::context &, ConnectionPool &);
   Client(const Client &) = delete;
   Client(Client &&) = default;
   ~Client() = default;
 
+  // request settings are applied on the strand, in order with the requests
+  // started after them
   void setRequestCookies(std::string cookies);
   std::string getResponseCookies() const;
+  // asks for bytes [first, last] of the body, whole body when last is empty
+  void setRequestRange(std::uint64_t first,
+                       boost::optional<std::uint64_t> last);
+  void clearRequestRange();
+  // whole body GETs go through the cache
+  void setResponseCache(ResponseCache &);
+  // delay doubles after each failed attempt of the same request
+  void setRetryPolicy(std::size_t maxRetries,
+                      std::chrono::milliseconds firstDelay);
+  void setTimeouts(const Timeouts &);
+  // aborts the request in progress from any thread, its future gets
+  // operation_aborted without any retry
+  void cancel();
+  // header of the last response, valid once its future is ready. Empty
+  // when the body was served by the cache without any request
+  const http::response_header<> &getResponseHeader() const;
 
-  std::future<std::string> get(const std::string &host, const std::string &port,
-                               const std::string &target);
+  std::future<Response> get(const std::string &host, const std::string &port,
+                            const std::string &target);
+  void asyncGet(const std::string &host, const std::string &port,
+                const std::string &target, ResponseHandler);
+  // response header only, see getResponseHeader
+  std::future<Response> head(const std::string &host, const std::string &port,
+                             const std::string &target);
+  void asyncHead(const std::string &host, const std::string &port,
+                 const std::string &target, ResponseHandler);
+
+  // body is handed to sink as it arrives from byte offset up to byte last
+  // included, stats give the number of bytes. A dropped connection is
+  // resumed with a Range request so the sink never sees the same byte twice
+  std::future<RequestStats> getStream(
+      const std::string &host, const std::string &port,
+      const std::string &target, BodySink &sink, std::uint64_t offset = 0,
+      boost::optional<std::uint64_t> last = boost::none);
+  void asyncGetStream(const std::string &host, const std::string &port,
+                      const std::string &target, BodySink &sink,
+                      std::uint64_t offset,
+                      boost::optional<std::uint64_t> last, StreamHandler);
 };
 
+// completion handler fulfilling a std::promise or a boost::fibers::promise
+template <typename T, typename Promise>
+std::function<void(std::exception_ptr, T)> makePromiseHandler(
+    std::shared_ptr<Promise> promise) {
+  return [promise](std::exception_ptr error, T result) {
+    if (error) {
+      promise->set_exception(error);
+    } else {
+      promise->set_value(std::move(result));
+    }
+  };
+}
+
 struct Url {
   Url();
   Url(const std::string &);
@@ -19,13 +19,18 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "JavascriptEngine.hpp"
 
+#include <algorithm>
 #include <boost/range.hpp>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <regex>
+#include <thread>
 #include <vector>
 
+#include "JavascriptLexer.hpp"
 #include "Utils.hpp"
 
 namespace JSEngine {
@@ -34,93 +39,199 @@ class Expression;
 class PtrExpression;
 typedef std::map<std::string, Expression *> Variables;
 typedef std::vector<PtrExpression> Expressions;
-typedef std::vector<std::unique_ptr<Expression> > UPtrExpressions;
 typedef std::string::const_iterator cstrIt;
 
+// value exchanged by expressions, javascript strings and char arrays are
+// both held in a std::string, integers are never turned into strings
+class Value {
+ public:
+  enum class Type : std::uint8_t { Undefined, Integer, String, CharArray };
+
+  Value() : _type(Type::Undefined), _integer(0), _string() {}
+
+  static Value integer(std::int64_t integer) {
+    Value value;
+    value._type = Type::Integer;
+    value._integer = integer;
+    return value;
+  }
+
+  static Value string(std::string string) {
+    Value value;
+    value._type = Type::String;
+    value._string = std::move(string);
+    return value;
+  }
+
+  static Value charArray(std::string chars) {
+    Value value = string(std::move(chars));
+    value._type = Type::CharArray;
+    return value;
+  }
+
+  Type getType() const { return _type; }
+
+  // 0 for what is not an integer
+  std::int64_t getInteger() const {
+    return _type == Type::Integer ? _integer : 0;
+  }
+
+  // empty for what is not a string or a char array
+  std::string &getString() { return _string; }
+  const std::string &getString() const { return _string; }
+
+ private:
+  Type _type;
+  std::int64_t _integer;
+  std::string _string;
+};
+
+std::ostream &operator<<(std::ostream &os, const Value &value) {
+  switch (value.getType()) {
+    case Value::Type::Undefined:
+      return os << "undefined";
+    case Value::Type::Integer:
+      return os << value.getInteger();
+    default:
+      return os << value.getString();
+  }
+}
+
 class Expression {
  public:
-  virtual std::string interpret() = 0;
+  virtual Value interpret() = 0;
+  // the value the expression holds, nullptr if it computes it
+  virtual Value *getValue() { return nullptr; }
   virtual ~Expression() {}
 };
 
-class ExpressionPool {
+// expressions of one interpretation, bump allocated in blocks and destroyed
+// all at once by clear(), the blocks are kept for the next interpretation
+class ExpressionArena {
+  static const std::size_t BlockSize = 16 * 1024;
+
+  std::vector<std::unique_ptr<char[]> > _blocks;
+  std::vector<std::size_t> _blockSizes;
+  // blocks before _idxBlock are full
+  std::size_t _idxBlock;
+  std::size_t _offset;
   std::vector<Expression *> _exprs;
 
  public:
-  ExpressionPool() : _exprs() {}
-
-  ExpressionPool(const ExpressionPool &) = delete;
-  ExpressionPool(ExpressionPool &&) = default;
-  ExpressionPool &operator=(const ExpressionPool &) = delete;
-  ExpressionPool &operator=(ExpressionPool &&) = default;
+  ExpressionArena()
+      : _blocks(), _blockSizes(), _idxBlock(0), _offset(0), _exprs() {}
+  ExpressionArena(const ExpressionArena &) = delete;
+  ExpressionArena(ExpressionArena &&) = delete;
+  ~ExpressionArena() { clear(); }
+
+  void *allocate(std::size_t size, std::size_t alignment) {
+    for (;;) {
+      if (_idxBlock == _blocks.size()) {
+        // BlockSize by value, std::max would odr-use it
+        const std::size_t blockSize =
+            size + alignment > BlockSize ? size + alignment : BlockSize;
+        _blocks.emplace_back(new char[blockSize]);
+        _blockSizes.push_back(blockSize);
+      }
+      const std::size_t begin =
+          (_offset + alignment - 1) / alignment * alignment;
+      if (begin + size <= _blockSizes[_idxBlock]) {
+        _offset = begin + size;
+        return _blocks[_idxBlock].get() + begin;
+      }
+      ++_idxBlock;
+      _offset = 0;
+    }
+  }
 
   template <typename T, typename... Args>
-  std::size_t makeExpression(Args... args) {
-    _exprs.push_back(new T(std::forward(args...)));
-    return _exprs.size() - 1;
+  T *makeExpression(Args &&... args) {
+    T *expr = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    _exprs.push_back(expr);
+    return expr;
   }
 
-  Expression *&operator[](std::size_t id) { return _exprs[id]; }
-
-  std::size_t push(Expression *expr) {
-    _exprs.push_back(expr);
-    return _exprs.size() - 1;
+  // a slot several PtrExpression share, reassigning it rebinds all of them
+  Expression **makeSlot(Expression *expr) {
+    Expression **slot = static_cast<Expression **>(
+        allocate(sizeof(Expression *), alignof(Expression *)));
+    *slot = expr;
+    return slot;
   }
 
-  ~ExpressionPool() {
-    std::for_each(_exprs.begin(), _exprs.end(),
-                  std::default_delete<Expression>());
+  void clear() {
+    std::for_each(_exprs.rbegin(), _exprs.rend(),
+                  [](Expression *expr) { expr->~Expression(); });
+    _exprs.clear();
+    _idxBlock = 0;
+    _offset = 0;
   }
 };
 
-static ExpressionPool &getExpressionPool() {
-  static ExpressionPool pool;
-  return pool;
-}
-
 class PtrExpression {
-  std::size_t _id;
+  ExpressionArena *_arena;
+  Expression **_slot;
 
  public:
-  PtrExpression(Expression *expr) : _id(getExpressionPool().push(expr)) {}
+  PtrExpression(ExpressionArena &arena, Expression *expr)
+      : _arena(&arena), _slot(arena.makeSlot(expr)) {}
 
-  Expression *operator->() { return getExpressionPool()[_id]; }
+  Expression *operator->() { return *_slot; }
 
-  void reset(Expression *expr) {
-    Expression *&exprReset = getExpressionPool()[_id];
-    delete exprReset;
-    exprReset = expr;
+  // the previous expression lives until the arena is cleared
+  template <typename T, typename... Args>
+  void emplace(Args &&... args) {
+    *_slot = _arena->makeExpression<T>(std::forward<Args>(args)...);
   }
 };
 
-class Str : public Expression {
-  std::string _str;
+template <typename T, typename... Args>
+PtrExpression makePtr(ExpressionArena &arena, Args &&... args) {
+  return PtrExpression(arena,
+                       arena.makeExpression<T>(std::forward<Args>(args)...));
+}
 
- public:
-  Str(std::string str) : _str(std::move(str)) {}
-  std::string interpret() override { return _str; }
+class Constant : public Expression {
+  Value _value;
 
-  std::string &getString() { return _str; }
+ public:
+  explicit Constant(Value value) : _value(std::move(value)) {}
+  Value interpret() override { return _value; }
+  Value *getValue() override { return &_value; }
 };
 
+// value of expr, without a copy when expr holds it
+const Value &evaluate(PtrExpression &expr, Value &scratch) {
+  Value *value = expr->getValue();
+  if (value != nullptr) {
+    return *value;
+  }
+  scratch = expr->interpret();
+  return scratch;
+}
+
 class Split : public Expression {
-  std::string _arg;
+  PtrExpression _arg;
 
  public:
-  Split(std::string str) : _arg(std::move(str)) {}
-  std::string interpret() override {
-    return _arg;
-  }  // string is already a char array ...
+  explicit Split(PtrExpression expr) : _arg(std::move(expr)) {}
+  Value interpret() override {
+    // same chars, only the type changes
+    Value value = _arg->interpret();
+    return Value::charArray(std::move(value.getString()));
+  }
 };
 
 class Join : public Expression {
-  std::string _arg;
+  PtrExpression _arg;
 
  public:
-  Join(std::string str) : _arg(std::move(str)) {}
-  std::string interpret() override {
-    return _arg;
-  }  // string is already a char array ...
+  explicit Join(PtrExpression expr) : _arg(std::move(expr)) {}
+  Value interpret() override {
+    Value value = _arg->interpret();
+    return Value::string(std::move(value.getString()));
+  }
 };
 
 class Reverse : public Expression {
@@ -128,12 +239,13 @@ class Reverse : public Expression {
 
  public:
   Reverse(PtrExpression expr) : _arg(std::move(expr)) {}
-  std::string interpret() override {
-    const std::string &argStr = _arg->interpret();
-    LOG << " reverse string : " << argStr;
-    std::string ret(argStr.crbegin(), argStr.crend());
-    LOG << " reversed string : " << ret;
-    return ret;
+  Value interpret() override {
+    Value value = _arg->interpret();
+    LOG_DEBUG << " reverse string : " << value;
+    std::string &str = value.getString();
+    std::reverse(str.begin(), str.end());
+    LOG_DEBUG << " reversed string : " << value;
+    return value;
   }
 };
 
@@ -143,34 +255,36 @@ class Splice : public Expression {
   PtrExpression _arg;
   std::size_t _start;
   std::size_t _deleteCnt;
-  UPtrExpressions _newItems;
+  Expressions _newItems;
 
  public:
   Splice(PtrExpression expr, std::size_t start, std::size_t deleteCnt,
-         UPtrExpressions newItems)
+         Expressions newItems)
       : _arg(std::move(expr)),
         _start(start),
         _deleteCnt(deleteCnt),
         _newItems(std::move(newItems)) {}
 
-  std::string interpret() override {
-    std::string str(_arg->interpret());
-    LOG << "splice string " << str << " start : " << _start << " delete cnt "
-        << _deleteCnt << " new Items size " << _newItems.size();
-    _start = std::min(_start, str.size());
-    if (_start < 0) {
-      _start = std::max(static_cast<std::size_t>(0), str.size() - _start + 1);
-    }
-    str.erase(_start, _deleteCnt);
-    for (const auto &newItem : _newItems) {
-      const std::string &itemVal = newItem->interpret();
+  Value interpret() override {
+    Value value = _arg->interpret();
+    std::string &str = value.getString();
+    LOG_DEBUG << "splice string " << str << " start : " << _start
+              << " delete cnt " << _deleteCnt << " new Items size "
+              << _newItems.size();
+    const std::size_t start = std::min(_start, str.size());
+    str.erase(start, _deleteCnt);
+    for (auto &newItem : _newItems) {
+      Value scratch;
+      const std::string &itemVal = evaluate(newItem, scratch).getString();
       if (itemVal.size() > 1) {
-        LOG << "Splice has an argument longer than 1 char : " << itemVal;
+        LOG_DEBUG << "Splice has an argument longer than 1 char : " << itemVal;
+      }
+      if (!itemVal.empty()) {
+        str.insert(start, 1, itemVal.front());
       }
-      str.insert(_start, 1, newItem->interpret().front());
     }
-    LOG << "spliced string " << str;
-    return str;
+    LOG_DEBUG << "spliced string " << str;
+    return value;
   }
 };
 
@@ -182,15 +296,18 @@ class Indexed : public Expression {
   Indexed(PtrExpression expr, PtrExpression idx)
       : _expr(std::move(expr)), _idx(std::move(idx)) {}
 
-  std::string interpret() override {
-    const std::string &str = _expr->interpret();
-    const std::string &idxStr = _idx->interpret();
-    LOG << "index " << idxStr << " on string " << str;
-    // idx should be a size_t
-    char *strEnd;
-    std::size_t idx = std::strtoull(idxStr.c_str(), &strEnd, 10);
-    LOG << "indexed string " << str[idx];
-    return std::string(1, str[idx]);
+  Value interpret() override {
+    Value strScratch;
+    Value idxScratch;
+    const std::string &str = evaluate(_expr, strScratch).getString();
+    const std::int64_t idx = evaluate(_idx, idxScratch).getInteger();
+    LOG_DEBUG << "index " << idx << " on string " << str;
+    if (idx < 0 || static_cast<std::size_t>(idx) >= str.size()) {
+      LOG_DEBUG << "index " << idx << " out of " << str.size() << " chars";
+      return Value();
+    }
+    LOG_DEBUG << "indexed string " << str[idx];
+    return Value::string(std::string(1, str[idx]));
   }
 };
 
@@ -202,16 +319,18 @@ class Modulo : public Expression {
   Modulo(PtrExpression lhs, PtrExpression rhs)
       : _lhs(std::move(lhs)), _rhs(std::move(rhs)) {}
 
-  std::string interpret() override {
-    const std::string &lhsStr = _lhs->interpret();
-    const std::string &rhsStr = _rhs->interpret();
-    LOG << "modulo on string " << lhsStr << " and " << rhsStr;
-    char *strEnd1;
-    const std::size_t lhsInt = std::strtoull(lhsStr.c_str(), &strEnd1, 10);
-    char *strEnd2;
-    const std::size_t rhsInt = std::strtoull(rhsStr.c_str(), &strEnd2, 10);
-    LOG << "moduloed string " << lhsInt % rhsInt;
-    return std::to_string(lhsInt % rhsInt);
+  Value interpret() override {
+    Value lhsScratch;
+    Value rhsScratch;
+    const std::int64_t lhs = evaluate(_lhs, lhsScratch).getInteger();
+    const std::int64_t rhs = evaluate(_rhs, rhsScratch).getInteger();
+    LOG_DEBUG << "modulo on " << lhs << " and " << rhs;
+    if (rhs == 0) {
+      // NaN in javascript
+      return Value();
+    }
+    LOG_DEBUG << "moduloed " << lhs % rhs;
+    return Value::integer(lhs % rhs);
   }
 };
 
@@ -221,10 +340,11 @@ class Length : public Expression {
  public:
   Length(PtrExpression expr) : _expr(std::move(expr)) {}
 
-  std::string interpret() override {
-    const std::string &str = _expr->interpret();
-    LOG << "length string " << str;
-    return std::to_string(str.size() /*_expr->interpret().size()*/);
+  Value interpret() override {
+    Value scratch;
+    const std::string &str = evaluate(_expr, scratch).getString();
+    LOG_DEBUG << "length string " << str;
+    return Value::integer(static_cast<std::int64_t>(str.size()));
   }
 };
 
@@ -239,11 +359,17 @@ class Assign : public Expression {
   Assign(PtrExpression from, PtrExpression to)
       : _from(std::move(from)), _to(std::move(to)) {}
 
-  std::string interpret() override {
-    const std::string &fromStr = _from->interpret();
-    LOG << "assign string " << fromStr;
-    _to.reset(new Str(fromStr));
-    return std::string();
+  Value interpret() override {
+    Value value = _from->interpret();
+    LOG_DEBUG << "assign value " << value;
+    // a Constant already in the slot takes the value, the arena does not grow
+    Value *to = _to->getValue();
+    if (to != nullptr) {
+      *to = std::move(value);
+    } else {
+      _to.emplace<Constant>(std::move(value));
+    }
+    return Value();
   }
 };
 
@@ -256,17 +382,24 @@ class AssignIndexed : public Expression {
   AssignIndexed(PtrExpression from, PtrExpression to, PtrExpression idx)
       : _from(std::move(from)), _to(std::move(to)), _idx(std::move(idx)) {}
 
-  std::string interpret() override {
-    // thats dangerous, find a better way ...
-    Str *toExpr = static_cast<Str *>(_to.operator->());
-    // not using interpret cause we need the reference
-    std::string &toStr = toExpr->getString();
-    const std::string &idxStr = _idx->interpret();
-    const std::string &fromStr = _from->interpret();
-    LOG << "assign " << fromStr << " to " << toStr << " at index " << idxStr;
-    char *endChar;
-    const std::size_t idx = std::strtoull(idxStr.c_str(), &endChar, 10);
-    toStr[idx] = fromStr[0];
+  Value interpret() override {
+    // not using interpret cause we need the stored value
+    Value *to = _to->getValue();
+    if (to == nullptr) {
+      LOG_DEBUG << "assign to an index of a computed value";
+      return Value();
+    }
+    std::string &toStr = to->getString();
+    Value idxScratch;
+    Value fromScratch;
+    const std::int64_t idx = evaluate(_idx, idxScratch).getInteger();
+    const std::string &fromStr = evaluate(_from, fromScratch).getString();
+    LOG_DEBUG << "assign " << fromStr << " to " << toStr << " at index " << idx;
+    if (idx >= 0 && static_cast<std::size_t>(idx) < toStr.size() &&
+        !fromStr.empty()) {
+      toStr[idx] = fromStr[0];
+    }
+    return Value();
   }
 };
 
@@ -274,12 +407,11 @@ class Nothing : public Expression {
  public:
   // void : empty expression
   // does literally nothing
-  std::string interpret() override { return std::string(); }
+  Value interpret() override { return Value(); }
 
-  static PtrExpression getNothing() {
-    // no need to allocate more than 1 instance, all do the same thing
-    static PtrExpression nothingExpr(new Nothing());
-    return nothingExpr;
+  static PtrExpression getNothing(ExpressionArena &arena) {
+    // a slot of its own, assigning to it must not change other nothings
+    return makePtr<Nothing>(arena);
   }
 };
 
@@ -299,40 +431,17 @@ static const std::string _indexed = "([[:alnum:]]+)\\[(.*)\\]";
 static const std::string _assignIndexed = _indexed + "=(.*)";
 // captures var name defined -> var a =
 static const std::string _define = "\\s*var\\s+([[:alnum:]]+)\\s*=\\s*";
-// captures function arguments and body -> : function(arguments) { body }
-static const std::string _defineFunctionNoName =
-    "\\s*[=:]\\s*function\\((\\s*[[:alnum:]]*[\\s,[:alnum:]]*)\\)\\{(.*)\\}";
-// captures function name, arguments and body -> fnName : function(arguments) {
-// body }
-static const std::string _defineFunction =
-    "\\s*([[:alnum:]]+)\\s*" + _defineFunctionNoName;
 // captures modulo call -> a%b
 static const std::string _modulo = "^(.+)%(.+)$";
-// capture signature decipher function name
-static const std::string _sigFn = "\"signature\"\\s*,\\s*([[:alnum:]]+)\\(";
 
 static const std::regex AssignMethod(_assign + _methodCall + _fnParams);
 static const std::regex AssignAny(_assignAny);
 static const std::regex MethodCall(_methodCall + _fnParams);
 static const std::regex InstanceProperty(_methodCall);
-static const std::regex DefineFunction(_defineFunction);
 static const std::regex Indexed(_indexed);
 static const std::regex DefineFromIndexed(_define + _indexed);
 static const std::regex AssignIndexed(_assignIndexed);
 static const std::regex Modulo(_modulo);
-static const std::regex SignatureFunction(_sigFn);
-//    static const std::regex rgx(fnName +
-//    "\\s*[=:]\\s*function\\((\\s*[[:alnum:]]*[\\s,[:alnum:]]*)\\)\\{(.*)\\}");
-
-// captures var definition -> var a = { definition };
-std::regex defineVar(const std::string &varName) {
-  return std::regex("\\s*var\\s+" + varName + "\\s*=\\s*\\{([\\S\\s]*?)\\};");
-}
-
-// captures function arguments and body -> fnName : function(arguments) { body }
-std::regex defineFunction(const std::string &fnName) {
-  return std::regex(fnName + _defineFunctionNoName);
-}
 }  // namespace Rgx
 
 void split(const std::string &str, char delim,
@@ -361,37 +470,49 @@ void split(const std::string &str, char delim,
         [&op](cstrIt itBeg, cstrIt itEnd) { op(std::string(itBeg, itEnd)); });
 }
 
+// fits in the integers of Value
 bool isInteger(const std::string &str) noexcept {
-  return str.find_first_not_of("0123456789") == std::string::npos;
+  return !str.empty() && str.size() <= 18 &&
+         str.find_first_not_of("0123456789") == std::string::npos;
 }
 
 class Function : public Expression {
+  // where the expressions of the function are created
+  ExpressionArena &_arena;
   const std::string _name;
-  const std::string _code;
   const std::string _vars;
+  const std::string _code;
   std::map<std::string, PtrExpression> _varMap;
   std::map<std::string, PtrExpression> _fnMap;
   Expressions _stack;
 
+  template <typename T, typename... Args>
+  PtrExpression make(Args &&... args) {
+    return makePtr<T>(_arena, std::forward<Args>(args)...);
+  }
+
+  PtrExpression nothing() { return Nothing::getNothing(_arena); }
+
  public:
-  Function() = default;
   Function(const Function &) = delete;
   Function &operator=(const Function &) = delete;
   ~Function() = default;
-  Function(Function &&other) = default;
-  Function &operator=(Function &&) = default;
+  Function(Function &&other) = delete;
+  Function &operator=(Function &&) = delete;
 
-  explicit Function(std::string name, std::string vars, std::string code)
-      : _name(std::move(name)),
+  explicit Function(ExpressionArena &arena, std::string name, std::string vars,
+                    std::string code)
+      : _arena(arena),
+        _name(std::move(name)),
         _vars(std::move(vars)),
         _code(std::move(code)),
-        _varMap() {
-    LOG << "function created, name : " << _name << " code : " << _code
-        << " vars : " << _vars;
+        _varMap(),
+        _fnMap(),
+        _stack() {
+    LOG_DEBUG << "function created, name : " << _name << " code : " << _code
+              << " vars : " << _vars;
   }
 
-  explicit Function(const std::smatch &sm) : Function(sm[1], sm[2], sm[3]) {}
-
   void setArguments(const Expressions &args) {
     _varMap.clear();
     split(_vars, ',', [this, &args](std::string &&varName) {
@@ -399,7 +520,25 @@ class Function : public Expression {
     });
   }
 
-  std::string getVar(const std::string &varName) {
+  // new values in the slots of the arguments, the parsed code reads them on
+  // the next interpret()
+  void rebindArguments(const std::vector<Value> &values) {
+    std::size_t idx = 0;
+    split(_vars, ',', [this, &values, &idx](std::string &&varName) {
+      auto itVar = this->_varMap.find(varName);
+      if (itVar != this->_varMap.end() && idx < values.size()) {
+        Value *value = itVar->second->getValue();
+        if (value != nullptr) {
+          *value = values[idx];
+        } else {
+          itVar->second.emplace<Constant>(values[idx]);
+        }
+      }
+      ++idx;
+    });
+  }
+
+  Value getVar(const std::string &varName) {
     auto it = _varMap.find(varName);
     return it->second->interpret();
   }
@@ -407,116 +546,124 @@ class Function : public Expression {
   PtrExpression parseMethodCall(const PtrExpression &instance,
                                 const std::string &methodName,
                                 const std::string &methodArgs) {
-    LOG << "call method " << methodName << " with args " << methodArgs;
-    if (methodName == "split" || methodName == "join") {
-      // nothing to do atm, string is already a char array in C++
-      return instance;
+    LOG_DEBUG << "call method " << methodName << " with args " << methodArgs;
+    if (methodName == "split") {
+      // same chars, string is already a char array in C++
+      return make<Split>(instance);
+    } else if (methodName == "join") {
+      return make<Join>(instance);
     } else if (methodName == "reverse") {
-      return PtrExpression(
-          new Assign(PtrExpression(new Reverse(instance)), instance));
+      return make<Assign>(make<Reverse>(instance), instance);
     } else if (methodName == "length") {
-      return PtrExpression(new Length(instance));
+      return make<Length>(instance);
     } else if (methodName == "splice") {
       int idx = 0;
       std::size_t spliceStart = 0;
       std::size_t spliceRemoveCnt = 0;
-      UPtrExpressions spliceArgs;
+      Expressions spliceArgs;
       split(methodArgs, ',',
             [this, &idx, &spliceStart, &spliceRemoveCnt,
              &spliceArgs](std::string &&argStr) {
               switch (idx) {
                 case 0: {
-                  const std::string &startStr =
-                      this->parseCode(argStr, "")->interpret();
-                  char *strEnd;
-                  spliceStart = std::strtoull(startStr.c_str(), &strEnd, 10);
+                  const std::int64_t start =
+                      this->parseCode(argStr, "")->interpret().getInteger();
+                  spliceStart = static_cast<std::size_t>(
+                      std::max<std::int64_t>(0, start));
                 } break;
 
                 case 1: {
-                  const std::string &removeCntStr =
-                      this->parseCode(argStr, "")->interpret();
-                  char *strEnd2;
-                  spliceRemoveCnt =
-                      std::strtoull(removeCntStr.c_str(), &strEnd2, 10);
+                  const std::int64_t removeCnt =
+                      this->parseCode(argStr, "")->interpret().getInteger();
+                  spliceRemoveCnt = static_cast<std::size_t>(
+                      std::max<std::int64_t>(0, removeCnt));
                 } break;
 
                 default:
-                  spliceArgs.push_back(
-                      std::unique_ptr<Expression>(new Str(argStr)));
+                  spliceArgs.push_back(this->make<Constant>(
+                      Value::string(std::move(argStr))));
                   break;
               }
               ++idx;
             });
-      return PtrExpression(
-          new Assign(new Splice(instance, spliceStart, spliceRemoveCnt,
-                                std::move(spliceArgs)),
-                     instance));
+      return make<Assign>(make<Splice>(instance, spliceStart, spliceRemoveCnt,
+                                       std::move(spliceArgs)),
+                          instance);
     }
-    return Nothing::getNothing();
+    return nothing();
   }
 
   PtrExpression parseCode(const std::string &toParse,
                           const std::string &jsCode) {
-    LOG << "search string " << toParse;
+    LOG_DEBUG << "search string " << toParse;
 
     std::smatch matches;
     auto itVarMap = _varMap.find(toParse);
     if (itVarMap != _varMap.cend()) {
-      LOG << "found var " << toParse;
+      LOG_DEBUG << "found var " << toParse;
       return itVarMap->second;
     } else if (isInteger(toParse)) {
-      LOG << "found integer " << toParse;
-      return PtrExpression(new Str(toParse));
+      LOG_DEBUG << "found integer " << toParse;
+      return make<Constant>(Value::integer(std::stoll(toParse)));
     }
     if (std::regex_search(toParse, matches, Rgx::AssignMethod)) {
       const std::string &varStr = matches[1].str();
       const std::string &instanceStr = matches[2].str();
       const std::string &methodStr = matches[3].str();
       const std::string &methodArgs = matches[4].str();
-      LOG << "found assign var " << varStr << " with method " << methodStr
-          << " from " << instanceStr << " with args " << methodArgs;
+      LOG_DEBUG << "found assign var " << varStr << " with method " << methodStr
+                << " from " << instanceStr << " with args " << methodArgs;
 
       auto itVar = _varMap.find(varStr);
       auto itInstance = _varMap.find(instanceStr);
       if (itVar == _varMap.cend()) {
-        LOG << "trying to assign undefined variable " << varStr;
+        LOG_DEBUG << "trying to assign undefined variable " << varStr;
       } else if (itInstance == _varMap.cend()) {
-        LOG << "trying to call " << methodStr << " from undefined instance "
-            << instanceStr;
+        LOG_DEBUG << "trying to call " << methodStr
+                  << " from undefined instance " << instanceStr;
       } else {
-        return PtrExpression(new Assign(
+        return make<Assign>(
             /*from*/ parseMethodCall(itInstance->second, methodStr, methodArgs),
-            /*to*/ itVar->second));
+            /*to*/ itVar->second);
       }
     } else if (std::regex_search(toParse, matches, Rgx::AssignIndexed)) {
       const std::string &to = matches[1].str();
       const std::string &index = matches[2].str();
       const std::string &from = matches[3].str();
-      LOG << "found assign " << from << " to " << to << " at index " << index;
-      return PtrExpression(new AssignIndexed(parseCode(from, jsCode),
-                                             parseCode(to, jsCode),
-                                             parseCode(index, jsCode)));
+      LOG_DEBUG << "found assign " << from << " to " << to << " at index "
+                << index;
+      return make<AssignIndexed>(parseCode(from, jsCode), parseCode(to, jsCode),
+                                 parseCode(index, jsCode));
 
     } else if (std::regex_search(toParse, matches, Rgx::AssignAny)) {
       const std::string &to = matches[1].str();
       const std::string &from = matches[2].str();
-      LOG << "found assign from " << from << " to " << to;
-
-      return PtrExpression(
-          new Assign(parseCode(from, jsCode), parseCode(to, jsCode)));
+      LOG_DEBUG << "found assign from " << from << " to " << to;
+
+      Lexer lexer(to);
+      if (lexer.accept("var")) {
+        // var c=a[0] : c needs a slot of its own, an unknown name only gets
+        // a nothing
+        const std::string &varName = lexer.identifier().to_string();
+        PtrExpression var = nothing();
+        _varMap.erase(varName);
+        _varMap.insert(std::make_pair(varName, var));
+        return make<Assign>(parseCode(from, jsCode), var);
+      }
+      return make<Assign>(parseCode(from, jsCode), parseCode(to, jsCode));
     } else if (std::regex_search(toParse, matches, Rgx::Indexed)) {
       const std::string &varStr = matches[1].str();
       const std::string &idxStr = matches[2].str();
-      LOG << "found var " << varStr << " indexed at " << idxStr;
+      LOG_DEBUG << "found var " << varStr << " indexed at " << idxStr;
 
-      return PtrExpression(
-          new Indexed(parseCode(varStr, jsCode), parseCode(idxStr, jsCode)));
+      return make<Indexed>(parseCode(varStr, jsCode),
+                           parseCode(idxStr, jsCode));
     } else if (std::regex_search(toParse, matches, Rgx::MethodCall)) {
       const std::string &varName = matches[1].str();
       const std::string &methodName = matches[2].str();
       const std::string &methodArgs = matches[3].str();
 
-      LOG << "found method " << methodName << " from " << varName;
+      LOG_DEBUG << "found method " << methodName << " from " << varName;
       auto itVar = _varMap.find(varName);
       if (itVar == _varMap.cend()) {
         // not a local variable, this is function containing variable
@@ -525,37 +672,34 @@ class Function : public Expression {
         auto itFn = _fnMap.find(fnKey);
         if (itFn == _fnMap.cend()) {
           // must find var def
-          std::smatch matchesVarDef;
-          LOG << " will try to find " << varName << "definition";
-          std::regex rgxVarDef(Rgx::defineVar(varName));
-          if (std::regex_search(jsCode, matchesVarDef,
-                                Rgx::defineVar(varName))) {
-            LOG << "found " << matches[1] << " definition " << matchesVarDef[1];
+          boost::string_view definition;
+          boost::string_view body;
+          LOG_DEBUG << " will try to find " << varName << "definition";
+          if (PlayerIndex(jsCode).findObject(varName, definition, body)) {
+            LOG_DEBUG << "found " << matches[1] << " definition " << body;
             // find the functions ...
-            std::smatch matchesInnerFn;
-            std::string s(matchesVarDef[1]);
-            LOG << "rgxDefineFn " << Rgx::_defineFunction;
-            auto rgxItBeg =
-                std::sregex_iterator(s.cbegin(), s.cend(), Rgx::DefineFunction);
-            auto rgxItEnd = std::sregex_iterator();
-            for (auto it = rgxItBeg; it != rgxItEnd; ++it) {
-              Function *fn = new Function(*it);
+            forEachMethod(body, [this, &varName, &fnKey, &itFn](
+                                    boost::string_view name,
+                                    boost::string_view vars,
+                                    boost::string_view code) {
+              Function *fn = _arena.makeExpression<Function>(
+                  _arena, name.to_string(), vars.to_string(), code.to_string());
               const std::string &newFnKey = varName + "." + fn->_name;
-              auto itFnInserted =
-                  _fnMap.insert(std::make_pair(newFnKey, PtrExpression(fn)));
+              auto itFnInserted = _fnMap.insert(
+                  std::make_pair(newFnKey, PtrExpression(_arena, fn)));
               if (newFnKey == fnKey) {
                 itFn = itFnInserted.first;
               }
-            }
+            });
           } else {
-            LOG << "could not find var definition : " << varName;
-            return Nothing::getNothing();
+            LOG_DEBUG << "could not find var definition : " << varName;
+            return nothing();
           }
         }
         if (itFn == _fnMap.cend()) {
-          LOG << "could not find fcnt " << methodName << "definition in "
-              << varName;
-          return Nothing::getNothing();
+          LOG_DEBUG << "could not find fcnt " << methodName << "definition in "
+                    << varName;
+          return nothing();
         }
 
         Expressions argValues;
@@ -567,15 +711,17 @@ class Function : public Expression {
           // a constant, always integers in our case
           // this might change in the future ...
           {
-            argValues.push_back(PtrExpression(new Str(s)));
+            argValues.push_back(this->make<Constant>(
+                isInteger(s) ? Value::integer(std::stoll(s))
+                             : Value::string(std::move(s))));
           }
         });
         Function *fnModel = static_cast<Function *>(itFn->second.operator->());
-        Function *fn =
-            new Function(fnModel->_name, fnModel->_vars, fnModel->_code);
+        Function *fn = _arena.makeExpression<Function>(
+            _arena, fnModel->_name, fnModel->_vars, fnModel->_code);
         fn->setArguments(argValues);
         fn->parseCode(jsCode);
-        return PtrExpression(fn);
+        return PtrExpression(_arena, fn);
       } else {
         // we call a method instance on a local var
         return parseMethodCall(itVar->second, methodName, methodArgs);
@@ -584,45 +730,45 @@ class Function : public Expression {
       const std::string &newVar = matches[1].str();
       const std::string &srcVar = matches[2].str();
       const std::string &indexStr = matches[3].str();
-      LOG << "Found define " << newVar << " from " << srcVar << " indexed at "
-          << indexStr;
+      LOG_DEBUG << "Found define " << newVar << " from " << srcVar
+                << " indexed at " << indexStr;
 
       PtrExpression idxExpr = parseCode(indexStr, jsCode);
 
       auto itSrcVar = _varMap.find(srcVar);
       if (itSrcVar == _varMap.cend()) {
-        LOG << "could not find src var " << srcVar << " to index for define ";
-        return Nothing::getNothing();
+        LOG_DEBUG << "could not find src var " << srcVar
+                  << " to index for define ";
+        return nothing();
       }
 
       auto itNewVar = _varMap.find(newVar);
       if (itNewVar != _varMap.cend()) {
-        itNewVar->second.reset(new Indexed(itSrcVar->second, idxExpr));
+        itNewVar->second.emplace<Indexed>(itSrcVar->second, idxExpr);
       } else {
         _varMap.insert(std::make_pair(
-            newVar, PtrExpression(new Indexed(itSrcVar->second, idxExpr))));
+            newVar, make<Indexed>(itSrcVar->second, idxExpr)));
       }
     } else if (std::regex_search(toParse, matches, Rgx::Modulo)) {
       const std::string &lhs = matches[1].str();
       const std::string &rhs = matches[2].str();
-      LOG << "found " << lhs << " modulo " << rhs;
-      return PtrExpression(
-          new Modulo(parseCode(lhs, jsCode), parseCode(rhs, jsCode)));
+      LOG_DEBUG << "found " << lhs << " modulo " << rhs;
+      return make<Modulo>(parseCode(lhs, jsCode), parseCode(rhs, jsCode));
     } else if (std::regex_search(toParse, matches, Rgx::InstanceProperty)) {
       const std::string &varStr = matches[1].str();
       const std::string &propertyStr = matches[2].str();
-      LOG << "found property " << propertyStr << " on " << varStr;
+      LOG_DEBUG << "found property " << propertyStr << " on " << varStr;
 
       auto itVar = _varMap.find(varStr);
       if (itVar == _varMap.cend()) {
-        LOG << "could not find var " << varStr;
+        LOG_DEBUG << "could not find var " << varStr;
       } else {
         // works like a method call without arguments
         return parseMethodCall(itVar->second, propertyStr, std::string());
       }
     }
 
-    return Nothing::getNothing();
+    return nothing();
   }
 
   PtrExpression parseCode(const std::string &jsCode) {
@@ -632,53 +778,505 @@ class Function : public Expression {
     return _stack.back();
   }
 
-  std::string interpret() override {
+  Value interpret() override {
     for (auto it = _stack.begin(); it != _stack.end(); ++it) {
       if (std::next(it) == _stack.end()) {
         return (*it)->interpret();
       }
       (*it)->interpret();
     }
+    return Value();
   }
 };
 
-Function findFunction(const std::string &jsCode, const std::string &fnName) {
-  // fnName = function(a, b, ...) { code } or fnName : funtion(a, b, ...) { code
-  // }
-  static const std::regex rgx(
-      fnName +
-      "\\s*[=:]\\s*function\\((\\s*[[:alnum:]]*[\\s,[:alnum:]]*)\\)\\{(.*)\\}");
-  std::smatch matches;
-  if (std::regex_search(jsCode, matches, rgx)) {
-    Function f(fnName, std::move(matches[1]), std::move(matches[2]));
-    return f;
+// name of the first object other than an argument whose method is called in
+// code -> helper.method(
+std::string findHelperName(const std::string &code, const std::string &vars) {
+  std::vector<std::string> varNames;
+  split(vars, ',', [&varNames](std::string &&varName) {
+    varNames.push_back(Lexer(varName).identifier().to_string());
+  });
+  Lexer lexer(code);
+  while (!lexer.atEnd()) {
+    const std::size_t pos = lexer.getPos();
+    const boost::string_view name = lexer.identifier();
+    if (name.empty()) {
+      lexer.setPos(pos + 1);
+    } else if (lexer.accept('.') && !lexer.identifier().empty() &&
+               lexer.accept('(') &&
+               std::find(varNames.cbegin(), varNames.cend(), name) ==
+                   varNames.cend()) {
+      return name.to_string();
+    }
+  }
+  return std::string();
+}
+
+void writeBlock(std::ofstream &ofs, const std::string &block) {
+  ofs << block.size() << " " << block;
+}
+
+bool readBlock(std::ifstream &ifs, std::string &block) {
+  std::size_t size = 0;
+  // a program is a few KB, anything bigger is a corrupted file
+  if (!(ifs >> size) || ifs.get() != ' ' || size > 1024 * 1024) {
+    return false;
+  }
+  block.resize(size);
+  return size == 0 || static_cast<bool>(ifs.read(&block[0], size));
+}
+
+Bytecode::Bytecode() : _ops() {}
+
+Bytecode::Bytecode(std::vector<Operation> ops) : _ops(std::move(ops)) {}
+
+bool Bytecode::empty() const { return _ops.empty(); }
+
+std::size_t Bytecode::size() const { return _ops.size(); }
+
+void Bytecode::run(std::string &signature) const {
+  for (const Operation &op : _ops) {
+    switch (op._code) {
+      case OpCode::Reverse:
+        std::reverse(signature.begin(), signature.end());
+        break;
+
+      case OpCode::Splice:
+        // erase moves the tail in place, never reallocates
+        signature.erase(0, std::min<std::size_t>(op._arg, signature.size()));
+        break;
+
+      case OpCode::Swap:
+        if (!signature.empty()) {
+          std::swap(signature[0], signature[op._arg % signature.size()]);
+        }
+        break;
+    }
+  }
+}
+
+DecipherProgram::DecipherProgram()
+    : _fnName(), _fnVars(), _fnCode(), _helperCode(), _bytecode() {}
+
+bool DecipherProgram::empty() const { return _fnCode.empty(); }
+
+DecipherProgram extractProgram(const std::string &jsCode) {
+  // one pass over the player, lookups are then done in the index
+  const PlayerIndex index(jsCode);
+  LOG << "player indexed : " << index.getNbFunctions() << " functions, "
+      << index.getNbObjects() << " objects";
+  DecipherProgram program;
+  program._fnName = index.getSignatureFnName();
+  if (program._fnName.empty()) {
+    LOG << "function name not found ";
+    return program;
+  }
+  LOG << "function name is " << program._fnName;
+  boost::string_view vars;
+  boost::string_view code;
+  if (!index.findFunction(program._fnName, vars, code)) {
+    LOG << "could not find function " << program._fnName;
+    return DecipherProgram();
+  }
+  program._fnVars = vars.to_string();
+  program._fnCode = code.to_string();
+
+  const std::string &helperName =
+      findHelperName(program._fnCode, program._fnVars);
+  boost::string_view helperDefinition;
+  boost::string_view helperBody;
+  if (!helperName.empty() &&
+      index.findObject(helperName, helperDefinition, helperBody)) {
+    program._helperCode = helperDefinition.to_string();
   } else {
-    LOG << "could not find function " << fnName;
-    return Function();
+    LOG << "no helper object found for " << program._fnName;
   }
+  LOG << "decipher program extracted : "
+      << program._fnCode.size() + program._helperCode.size()
+      << " bytes out of " << jsCode.size();
+  program._bytecode = compile(program);
+  return program;
 }
 
-std::string findSignatureFnName(const std::string &jsCode) {
-  std::smatch funcNameMatch;
-  std::regex rgx("\"signature\"\\s*,\\s*([[:alnum:]]+)\\(");
-  if (std::regex_search(jsCode, funcNameMatch, rgx)) {
-    LOG << "function name is " << funcNameMatch[1];
-    return funcNameMatch[1].str();
+// what a helper method does to its first argument, guessed from its body
+bool classifyHelperMethod(const std::string &arrayName,
+                          const std::string &code, OpCode &opCode) {
+  if (arrayName.empty()) {
+    return false;
+  }
+  if (code.find(arrayName + ".reverse(") != std::string::npos) {
+    opCode = OpCode::Reverse;
+  } else if (code.find(arrayName + ".splice(0,") != std::string::npos) {
+    opCode = OpCode::Splice;
+  } else if (code.find("%" + arrayName + ".length") != std::string::npos) {
+    opCode = OpCode::Swap;
   } else {
-    LOG << "function name not found ";
+    return false;
   }
-  return std::string();
+  return true;
 }
 
-std::string decipherSignature(const std::string &jsCode,
+// a=a.split("") and return a.join("") only convert the char array
+bool isConversion(boost::string_view statement) {
+  Lexer lexer(statement);
+  if (!lexer.accept("return")) {
+    if (lexer.identifier().empty() || !lexer.accept('=')) {
+      lexer.setPos(0);
+    }
+  }
+  if (lexer.identifier().empty() || !lexer.accept('.') ||
+      !(lexer.accept("split") || lexer.accept("join")) ||
+      !(lexer.accept("(\"\")") || lexer.accept("('')"))) {
+    return false;
+  }
+  lexer.skipSpaces();
+  return lexer.atEnd();
+}
+
+// helper.method(array,constant)
+bool parseHelperCall(boost::string_view statement, boost::string_view &method,
+                     boost::string_view &array, std::uint32_t &constant) {
+  Lexer lexer(statement);
+  if (lexer.identifier().empty() || !lexer.accept('.')) {
+    return false;
+  }
+  method = lexer.identifier();
+  if (method.empty() || !lexer.accept('(')) {
+    return false;
+  }
+  array = lexer.identifier();
+  if (array.empty() || !lexer.accept(',')) {
+    return false;
+  }
+  const boost::string_view number = lexer.number();
+  if (number.empty() || number.size() > 9 || !lexer.accept(')')) {
+    return false;
+  }
+  lexer.skipSpaces();
+  constant = 0;
+  for (char digit : number) {
+    constant = constant * 10 + static_cast<std::uint32_t>(digit - '0');
+  }
+  return lexer.atEnd();
+}
+
+Bytecode compile(const DecipherProgram &program) {
+  std::map<std::string, OpCode> methods;
+  boost::string_view helperDefinition;
+  boost::string_view helperBody;
+  Lexer helperLexer(program._helperCode);
+  const boost::string_view helperName =
+      helperLexer.accept("var") ? helperLexer.identifier()
+                                : boost::string_view();
+  if (!helperName.empty() &&
+      PlayerIndex(program._helperCode)
+          .findObject(helperName.to_string(), helperDefinition, helperBody)) {
+    forEachMethod(helperBody, [&methods](boost::string_view name,
+                                         boost::string_view vars,
+                                         boost::string_view code) {
+      OpCode opCode;
+      if (classifyHelperMethod(Lexer(vars).identifier().to_string(),
+                               code.to_string(), opCode)) {
+        methods.insert(std::make_pair(name.to_string(), opCode));
+      } else {
+        LOG << "helper method not compiled : " << name << " " << code;
+      }
+    });
+  }
+
+  const std::string &arrayName =
+      Lexer(program._fnVars).identifier().to_string();
+  std::vector<Operation> ops;
+  bool isCompiled = !arrayName.empty();
+  split(program._fnCode, ';',
+        [&methods, &arrayName, &ops, &isCompiled](std::string &&statement) {
+          if (!isCompiled || isConversion(statement)) {
+            return;
+          }
+          boost::string_view method;
+          boost::string_view array;
+          std::uint32_t constant = 0;
+          auto itMethod = methods.cend();
+          if (parseHelperCall(statement, method, array, constant) &&
+              array == arrayName) {
+            itMethod = methods.find(method.to_string());
+          }
+          if (itMethod == methods.cend()) {
+            LOG << "statement not compiled : " << statement;
+            isCompiled = false;
+            return;
+          }
+          ops.push_back(Operation{itMethod->second, constant});
+        });
+
+  if (!isCompiled || ops.empty()) {
+    LOG << "signature function " << program._fnName
+        << " left to the interpreter";
+    return Bytecode();
+  }
+  LOG << "signature function " << program._fnName << " compiled to "
+      << ops.size() << " operations";
+  return Bytecode(std::move(ops));
+}
+
+Engine::Engine() : _mutex(), _arenas() {}
+
+Engine::~Engine() = default;
+
+std::unique_ptr<ExpressionArena> Engine::acquireArena() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_arenas.empty()) {
+      std::unique_ptr<ExpressionArena> arena = std::move(_arenas.back());
+      _arenas.pop_back();
+      return arena;
+    }
+  }
+  return std::unique_ptr<ExpressionArena>(new ExpressionArena());
+}
+
+void Engine::releaseArena(std::unique_ptr<ExpressionArena> arena) {
+  arena->clear();
+  std::lock_guard<std::mutex> lock(_mutex);
+  _arenas.push_back(std::move(arena));
+}
+
+std::string Engine::interpret(const DecipherProgram &program,
                               const std::string &signature) {
-  const std::string &fnName = findSignatureFnName(jsCode);
-  // move
-  Function signatureFunction = findFunction(jsCode, fnName);
+  // gives the arena back even if interpreting throws
+  struct ArenaGuard {
+    Engine &_engine;
+    std::unique_ptr<ExpressionArena> _arena;
+    ~ArenaGuard() { _engine.releaseArena(std::move(_arena)); }
+  } guard{*this, acquireArena()};
+  ExpressionArena &arena = *guard._arena;
+
+  Function signatureFunction(arena, program._fnName, program._fnVars,
+                             program._fnCode);
   signatureFunction.setArguments(
-      Expressions{PtrExpression(new Str(signature))});
-  signatureFunction.parseCode(jsCode);
-  return signatureFunction.interpret();
+      Expressions{makePtr<Constant>(arena, Value::string(signature))});
+  // helper definitions are looked up in the program only
+  signatureFunction.parseCode(program._helperCode);
+  return signatureFunction.interpret().getString();
+}
+
+std::string Engine::decipherSignature(const DecipherProgram &program,
+                                      const std::string &signature) {
+  if (program._bytecode.empty()) {
+    return interpret(program, signature);
+  }
+  std::string deciphered(signature);
+  program._bytecode.run(deciphered);
+  return deciphered;
+}
+
+std::string Engine::decipherSignature(const std::string &jsCode,
+                                      const std::string &signature) {
+  return decipherSignature(extractProgram(jsCode), signature);
+}
+
+std::vector<std::string> Engine::decipherSignatures(
+    const DecipherProgram &program,
+    const std::vector<std::string> &signatures) {
+  // below this a thread costs more than the signatures it would take
+  const std::size_t minSignaturesPerThread =
+      program._bytecode.empty() ? 4 : 16 * 1024;
+  const std::size_t nbThreads = std::min<std::size_t>(
+      std::max(1u, std::thread::hardware_concurrency()),
+      signatures.size() / minSignaturesPerThread);
+
+  std::vector<std::string> deciphered(signatures.size());
+  auto decipherRange = [this, &program, &signatures, &deciphered](
+                           std::size_t begin, std::size_t end) {
+    for (std::size_t idx = begin; idx < end; ++idx) {
+      deciphered[idx] = decipherSignature(program, signatures[idx]);
+    }
+  };
+  if (nbThreads <= 1) {
+    decipherRange(0, signatures.size());
+    return deciphered;
+  }
+
+  LOG << "deciphering " << signatures.size() << " signatures on " << nbThreads
+      << " threads";
+  // each thread writes its own range of results
+  std::vector<std::future<void> > ranges;
+  const std::size_t rangeSize =
+      (signatures.size() + nbThreads - 1) / nbThreads;
+  for (std::size_t begin = rangeSize; begin < signatures.size();
+       begin += rangeSize) {
+    ranges.push_back(std::async(
+        std::launch::async, decipherRange, begin,
+        std::min(begin + rangeSize, signatures.size())));
+  }
+  decipherRange(0, rangeSize);
+  for (std::future<void> &range : ranges) {
+    range.get();
+  }
+  return deciphered;
+}
+
+std::vector<std::string> Engine::decipherSignatures(
+    const std::string &jsCode, const std::vector<std::string> &signatures) {
+  return decipherSignatures(extractProgram(jsCode), signatures);
+}
+
+Engine &getEngine() {
+  static Engine engine;
+  return engine;
+}
+
+std::string decipherSignature(const DecipherProgram &program,
+                              const std::string &signature) {
+  return getEngine().decipherSignature(program, signature);
+}
+
+std::string decipherSignature(const std::string &jsCode,
+                              const std::string &signature) {
+  return getEngine().decipherSignature(jsCode, signature);
+}
+
+std::vector<std::string> decipherSignatures(
+    const DecipherProgram &program,
+    const std::vector<std::string> &signatures) {
+  return getEngine().decipherSignatures(program, signatures);
+}
+
+std::vector<std::string> decipherSignatures(
+    const std::string &jsCode, const std::vector<std::string> &signatures) {
+  return getEngine().decipherSignatures(jsCode, signatures);
+}
+
+void benchmarkDecipher(const DecipherProgram &program,
+                       const std::string &signature, std::size_t nbRuns,
+                       std::ostream &os) {
+  typedef std::chrono::steady_clock Clock;
+  nbRuns = std::max<std::size_t>(1, nbRuns);
+
+  Engine engine;
+  std::string interpreted;
+  const Clock::time_point interpreterStart = Clock::now();
+  for (std::size_t run = 0; run < nbRuns; ++run) {
+    interpreted = engine.interpret(program, signature);
+  }
+  const Clock::duration interpreterTime = Clock::now() - interpreterStart;
+
+  // interpret() alone, the function is parsed once and its argument rebound
+  std::string looped;
+  Clock::duration loopTime;
+  {
+    ExpressionArena arena;
+    Function signatureFunction(arena, program._fnName, program._fnVars,
+                               program._fnCode);
+    signatureFunction.setArguments(
+        Expressions{makePtr<Constant>(arena, Value::string(signature))});
+    signatureFunction.parseCode(program._helperCode);
+    const std::vector<Value> arguments{Value::string(signature)};
+    const Clock::time_point loopStart = Clock::now();
+    for (std::size_t run = 0; run < nbRuns; ++run) {
+      signatureFunction.rebindArguments(arguments);
+      looped = signatureFunction.interpret().getString();
+    }
+    loopTime = Clock::now() - loopStart;
+  }
+
+  // one buffer for all runs, as a steady state caller would do
+  std::string compiled;
+  compiled.reserve(signature.size());
+  const Clock::time_point bytecodeStart = Clock::now();
+  for (std::size_t run = 0; run < nbRuns; ++run) {
+    compiled.assign(signature);
+    program._bytecode.run(compiled);
+  }
+  const Clock::duration bytecodeTime = Clock::now() - bytecodeStart;
+
+  // large enough batches are split among threads
+  const std::vector<std::string> signatures(nbRuns, signature);
+  const Clock::time_point batchStart = Clock::now();
+  const std::vector<std::string> batch =
+      engine.decipherSignatures(program, signatures);
+  const Clock::duration batchTime = Clock::now() - batchStart;
+  const bool isBatchEqual =
+      std::all_of(batch.cbegin(), batch.cend(),
+                  [&interpreted](const std::string &deciphered) {
+                    return deciphered == interpreted;
+                  });
+
+  typedef std::chrono::nanoseconds ns;
+  os << "tree interpreter : "
+     << std::chrono::duration_cast<ns>(interpreterTime).count() / nbRuns
+     << " ns per signature\n"
+     << "tree interpreter, parsed once : "
+     << std::chrono::duration_cast<ns>(loopTime).count() / nbRuns
+     << " ns per signature\n"
+     << "bytecode (" << program._bytecode.size() << " operations) : "
+     << std::chrono::duration_cast<ns>(bytecodeTime).count() / nbRuns
+     << " ns per signature\n"
+     << "batch of " << nbRuns << " : "
+     << std::chrono::duration_cast<ns>(batchTime).count() / nbRuns
+     << " ns per signature\n";
+  if (looped != interpreted) {
+    os << "parsed once results differ : " << interpreted << " and " << looped
+       << "\n";
+  }
+  if (!isBatchEqual) {
+    os << "batch results differ from " << interpreted << "\n";
+  }
+  if (program._bytecode.empty()) {
+    os << "signature function could not be compiled\n";
+  } else if (interpreted != compiled) {
+    os << "results differ : " << interpreted << " and " << compiled << "\n";
+  }
+}
+
+ProgramCache::ProgramCache() : _mutex(), _programs() {}
+
+DecipherProgram ProgramCache::find(const std::string &playerPath) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  auto itProgram = _programs.find(playerPath);
+  if (itProgram == _programs.end()) {
+    return DecipherProgram();
+  }
+  return itProgram->second;
+}
+
+void ProgramCache::store(const std::string &playerPath,
+                         DecipherProgram program) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _programs[playerPath] = std::move(program);
+}
+
+void ProgramCache::load(const std::string &filePath) {
+  // each program : player path, function name, vars, code, helper code
+  std::ifstream ifs(filePath, std::ifstream::binary);
+  std::string playerPath;
+  DecipherProgram program;
+  std::lock_guard<std::mutex> lock(_mutex);
+  while (readBlock(ifs, playerPath) && readBlock(ifs, program._fnName) &&
+         readBlock(ifs, program._fnVars) && readBlock(ifs, program._fnCode) &&
+         readBlock(ifs, program._helperCode)) {
+    // bytecode is cheap to rebuild and follows compiler fixes
+    program._bytecode = compile(program);
+    _programs[playerPath] = program;
+  }
+  LOG << _programs.size() << " decipher programs loaded from " << filePath;
+}
+
+void ProgramCache::save(const std::string &filePath) const {
+  std::ofstream ofs(filePath, std::ofstream::binary | std::ofstream::trunc);
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto &program : _programs) {
+    writeBlock(ofs, program.first);
+    writeBlock(ofs, program.second._fnName);
+    writeBlock(ofs, program.second._fnVars);
+    writeBlock(ofs, program.second._fnCode);
+    writeBlock(ofs, program.second._helperCode);
+  }
+}
+
+ProgramCache &getProgramCache() {
+  static ProgramCache cache;
+  return cache;
 }
 
 }  // namespace JSEngine
@@ -20,11 +20,140 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef JAVASCRIPT_ENGINE_HPP
 #define JAVASCRIPT_ENGINE_HPP
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <vector>
 
 namespace JSEngine {
+
+// the transforms player helpers apply on the signature char array
+enum class OpCode : std::uint8_t {
+  Reverse,  // a.reverse()
+  Splice,   // a.splice(0, arg)
+  Swap      // swaps a[0] and a[arg % a.length]
+};
+
+struct Operation {
+  OpCode _code;
+  std::uint32_t _arg;
+};
+
+// signature function lowered to a flat list of operations run in place on
+// the signature, no expression tree nor intermediate strings
+class Bytecode {
+  std::vector<Operation> _ops;
+
+ public:
+  Bytecode();
+  explicit Bytecode(std::vector<Operation> ops);
+
+  bool empty() const;
+  std::size_t size() const;
+
+  void run(std::string& signature) const;
+};
+
+// the part of a player script needed to decipher signatures : the signature
+// function and the helper object it calls, a few hundred bytes
+struct DecipherProgram {
+  DecipherProgram();
+  bool empty() const;
+
+  std::string _fnName;
+  std::string _fnVars;
+  std::string _fnCode;
+  // var helper={...}; as found in the player
+  std::string _helperCode;
+  // empty if the function does more than the known helpers, the tree
+  // interpreter is used then
+  Bytecode _bytecode;
+};
+
+// empty if the signature function is not found
+DecipherProgram extractProgram(const std::string& jsCode);
+
+// empty bytecode if a statement or a helper is not understood
+Bytecode compile(const DecipherProgram& program);
+
+class ExpressionArena;
+
+// runs the bytecode, or the tree interpreter when there is none, each
+// interpretation borrows an arena of the engine and frees its expressions at
+// once when done, so threads sharing an engine run on their own arenas
+class Engine {
+  std::mutex _mutex;
+  // arenas not in use, kept with their memory
+  std::vector<std::unique_ptr<ExpressionArena> > _arenas;
+
+ public:
+  Engine();
+  ~Engine();
+  Engine(const Engine&) = delete;
+  Engine(Engine&&) = delete;
+
+  std::string decipherSignature(const DecipherProgram& program,
+                                const std::string& signature);
+  std::string decipherSignature(const std::string& jsCode,
+                                const std::string& signature);
+  // program is extracted and compiled once for all signatures, large batches
+  // are split among threads, results are in the order of signatures
+  std::vector<std::string> decipherSignatures(
+      const DecipherProgram& program,
+      const std::vector<std::string>& signatures);
+  std::vector<std::string> decipherSignatures(
+      const std::string& jsCode, const std::vector<std::string>& signatures);
+  // tree interpreter even if the program has bytecode
+  std::string interpret(const DecipherProgram& program,
+                        const std::string& signature);
+
+ private:
+  std::unique_ptr<ExpressionArena> acquireArena();
+  void releaseArena(std::unique_ptr<ExpressionArena> arena);
+};
+
+// engine of the free functions below
+Engine& getEngine();
+
+std::string decipherSignature(const DecipherProgram& program,
+                              const std::string& signature);
 std::string decipherSignature(const std::string& jsCode,
                               const std::string& signature);
-}
+std::vector<std::string> decipherSignatures(
+    const DecipherProgram& program, const std::vector<std::string>& signatures);
+std::vector<std::string> decipherSignatures(
+    const std::string& jsCode, const std::vector<std::string>& signatures);
+
+// deciphers signature nbRuns times with the tree interpreter, then with the
+// bytecode, then as one batch of nbRuns signatures and prints the timings
+void benchmarkDecipher(const DecipherProgram& program,
+                       const std::string& signature, std::size_t nbRuns,
+                       std::ostream& os);
+
+// programs keyed by player path, a player version always deciphers the same
+// way so a known player is neither downloaded nor parsed again
+class ProgramCache {
+  mutable std::mutex _mutex;
+  std::map<std::string, DecipherProgram> _programs;
+
+ public:
+  ProgramCache();
+  ProgramCache(const ProgramCache&) = delete;
+  ProgramCache(ProgramCache&&) = delete;
+
+  // empty program if unknown
+  DecipherProgram find(const std::string& playerPath) const;
+  void store(const std::string& playerPath, DecipherProgram program);
+
+  void load(const std::string& filePath);
+  void save(const std::string& filePath) const;
+};
+
+ProgramCache& getProgramCache();
+
+}  // namespace JSEngine
 
 #endif
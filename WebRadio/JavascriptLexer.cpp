@@ -0,0 +1,328 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "JavascriptLexer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+
+namespace JSEngine {
+
+namespace {
+
+bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+// start of the spaces ending at end
+std::size_t skipSpacesBack(boost::string_view code, std::size_t end) {
+  while (end > 0 && isSpace(code[end - 1])) {
+    --end;
+  }
+  return end;
+}
+
+// identifier ending at end, empty if there is none
+boost::string_view identifierBefore(boost::string_view code, std::size_t end) {
+  std::size_t begin = end;
+  while (begin > 0 && isIdentifierChar(code[begin - 1])) {
+    --begin;
+  }
+  if (begin == end || isDigit(code[begin])) {
+    return boost::string_view();
+  }
+  return code.substr(begin, end - begin);
+}
+
+// word ends at end and is not the end of a longer identifier
+bool endsWithWord(boost::string_view code, std::size_t end,
+                  boost::string_view word) {
+  if (end < word.size() ||
+      code.substr(end - word.size(), word.size()) != word) {
+    return false;
+  }
+  const std::size_t begin = end - word.size();
+  return begin == 0 || !isIdentifierChar(code[begin - 1]);
+}
+
+// a single =, not part of == != <= >= =>
+bool isAssignBefore(boost::string_view code, std::size_t end) {
+  return end > 0 && code[end - 1] == '=' &&
+         (end < 2 || code[end - 2] == '\0' ||
+          std::strchr("=!<>+-*/%&|^", code[end - 2]) == nullptr);
+}
+
+// bytes where a definition or the signature call may be anchored
+std::array<bool, 256> makeAnchors() {
+  std::array<bool, 256> anchors{};
+  anchors[static_cast<unsigned char>('"')] = true;
+  anchors[static_cast<unsigned char>('(')] = true;
+  anchors[static_cast<unsigned char>('{')] = true;
+  return anchors;
+}
+
+}  // namespace
+
+bool isIdentifierChar(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '$' || c == '_';
+}
+
+Lexer::Lexer(boost::string_view code, std::size_t pos)
+    : _code(code), _pos(std::min(pos, code.size())) {}
+
+std::size_t Lexer::getPos() const { return _pos; }
+
+void Lexer::setPos(std::size_t pos) { _pos = std::min(pos, _code.size()); }
+
+bool Lexer::atEnd() const { return _pos == _code.size(); }
+
+void Lexer::skipSpaces() {
+  while (_pos < _code.size() && isSpace(_code[_pos])) {
+    ++_pos;
+  }
+}
+
+bool Lexer::accept(char c) {
+  skipSpaces();
+  if (_pos < _code.size() && _code[_pos] == c) {
+    ++_pos;
+    return true;
+  }
+  return false;
+}
+
+bool Lexer::accept(boost::string_view word) {
+  skipSpaces();
+  if (_code.substr(_pos, word.size()) != word) {
+    return false;
+  }
+  // "var" must not accept the beginning of "variable"
+  const std::size_t end = _pos + word.size();
+  if (!word.empty() && isIdentifierChar(word.back()) && end < _code.size() &&
+      isIdentifierChar(_code[end])) {
+    return false;
+  }
+  _pos = end;
+  return true;
+}
+
+boost::string_view Lexer::identifier() {
+  skipSpaces();
+  std::size_t end = _pos;
+  if (end < _code.size() && isDigit(_code[end])) {
+    return boost::string_view();
+  }
+  while (end < _code.size() && isIdentifierChar(_code[end])) {
+    ++end;
+  }
+  const boost::string_view ident = _code.substr(_pos, end - _pos);
+  _pos = end;
+  return ident;
+}
+
+boost::string_view Lexer::number() {
+  skipSpaces();
+  std::size_t end = _pos;
+  while (end < _code.size() && isDigit(_code[end])) {
+    ++end;
+  }
+  const boost::string_view num = _code.substr(_pos, end - _pos);
+  _pos = end;
+  return num;
+}
+
+bool Lexer::skipPast(char c) {
+  const void *found =
+      std::memchr(_code.data() + _pos, c, _code.size() - _pos);
+  if (found == nullptr) {
+    _pos = _code.size();
+    return false;
+  }
+  _pos = static_cast<const char *>(found) - _code.data() + 1;
+  return true;
+}
+
+bool Lexer::block(boost::string_view &inside) {
+  skipSpaces();
+  if (_pos == _code.size() || _code[_pos] == '\0' ||
+      std::strchr("([{", _code[_pos]) == nullptr) {
+    return false;
+  }
+  const std::size_t begin = _pos + 1;
+  std::size_t depth = 0;
+  while (_pos < _code.size()) {
+    const char c = _code[_pos++];
+    if (c == '(' || c == '[' || c == '{') {
+      ++depth;
+    } else if (c == ')' || c == ']' || c == '}') {
+      if (--depth == 0) {
+        inside = _code.substr(begin, _pos - 1 - begin);
+        return true;
+      }
+    } else if (c == '"' || c == '\'') {
+      // closing quote not escaped by an odd number of backslashes
+      bool isClosed = false;
+      while (!isClosed && skipPast(c)) {
+        std::size_t nbBackslashes = 0;
+        while (_code[_pos - 2 - nbBackslashes] == '\\') {
+          ++nbBackslashes;
+        }
+        isClosed = nbBackslashes % 2 == 0;
+      }
+    }
+  }
+  return false;
+}
+
+void forEachMethod(
+    boost::string_view objectBody,
+    const std::function<void(boost::string_view name, boost::string_view vars,
+                             boost::string_view code)> &op) {
+  Lexer lexer(objectBody);
+  do {
+    const boost::string_view name = lexer.identifier();
+    boost::string_view vars;
+    boost::string_view code;
+    if (name.empty() || !lexer.accept(':') || !lexer.accept("function") ||
+        !lexer.block(vars) || !lexer.block(code)) {
+      return;
+    }
+    op(name, vars, code);
+  } while (lexer.accept(','));
+}
+
+PlayerIndex::PlayerIndex(boost::string_view code)
+    : _code(code), _functions(), _objects(), _signatureFnName() {
+  static const std::array<bool, 256> anchors = makeAnchors();
+  const char *const data = code.data();
+  for (std::size_t pos = 0; pos < code.size(); ++pos) {
+    if (!anchors[static_cast<unsigned char>(data[pos])]) {
+      continue;
+    }
+    switch (data[pos]) {
+      case '(':
+        indexFunction(pos);
+        break;
+      case '{':
+        indexObject(pos);
+        break;
+      default:
+        indexSignatureCall(pos);
+        break;
+    }
+  }
+}
+
+const std::string &PlayerIndex::getSignatureFnName() const {
+  return _signatureFnName;
+}
+
+std::size_t PlayerIndex::getNbFunctions() const { return _functions.size(); }
+
+std::size_t PlayerIndex::getNbObjects() const { return _objects.size(); }
+
+bool PlayerIndex::findFunction(const std::string &name,
+                               boost::string_view &vars,
+                               boost::string_view &body) const {
+  auto itFunction = _functions.find(name);
+  if (itFunction == _functions.cend()) {
+    return false;
+  }
+  Lexer lexer(_code, itFunction->second);
+  return lexer.block(vars) && lexer.block(body);
+}
+
+bool PlayerIndex::findObject(const std::string &name,
+                             boost::string_view &definition,
+                             boost::string_view &body) const {
+  auto itObject = _objects.find(name);
+  if (itObject == _objects.cend()) {
+    return false;
+  }
+  Lexer lexer(_code, itObject->second.second);
+  if (!lexer.block(body)) {
+    return false;
+  }
+  lexer.accept(';');
+  definition = _code.substr(itObject->second.first,
+                            lexer.getPos() - itObject->second.first);
+  return true;
+}
+
+void PlayerIndex::indexFunction(std::size_t openPos) {
+  // name = function (
+  std::size_t end = skipSpacesBack(_code, openPos);
+  if (!endsWithWord(_code, end, "function")) {
+    return;
+  }
+  end = skipSpacesBack(_code, end - 8);
+  if (end == 0 || (_code[end - 1] != ':' && !isAssignBefore(_code, end))) {
+    return;
+  }
+  end = skipSpacesBack(_code, end - 1);
+  const boost::string_view name = identifierBefore(_code, end);
+  // obj.name = function is a property, not the function we look for
+  if (name.empty() ||
+      (end > name.size() && _code[end - name.size() - 1] == '.')) {
+    return;
+  }
+  // the first definition wins, as the regex search did
+  _functions.emplace(name.to_string(), openPos);
+}
+
+void PlayerIndex::indexObject(std::size_t openPos) {
+  // var name = {
+  std::size_t end = skipSpacesBack(_code, openPos);
+  if (!isAssignBefore(_code, end)) {
+    return;
+  }
+  end = skipSpacesBack(_code, end - 1);
+  const boost::string_view name = identifierBefore(_code, end);
+  if (name.empty()) {
+    return;
+  }
+  const std::size_t varEnd = skipSpacesBack(_code, end - name.size());
+  if (varEnd == end - name.size() || !endsWithWord(_code, varEnd, "var")) {
+    return;
+  }
+  _objects.emplace(name.to_string(), std::make_pair(varEnd - 3, openPos));
+}
+
+void PlayerIndex::indexSignatureCall(std::size_t quotePos) {
+  // "signature",name(
+  static const boost::string_view signatureKey("\"signature\"");
+  if (!_signatureFnName.empty() ||
+      _code.substr(quotePos, signatureKey.size()) != signatureKey) {
+    return;
+  }
+  Lexer lexer(_code, quotePos + signatureKey.size());
+  if (!lexer.accept(',')) {
+    return;
+  }
+  const boost::string_view name = lexer.identifier();
+  if (!name.empty() && lexer.accept('(')) {
+    _signatureFnName = name.to_string();
+  }
+}
+
+}  // namespace JSEngine
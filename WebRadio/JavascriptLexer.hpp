@@ -0,0 +1,100 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef JAVASCRIPT_LEXER_HPP_
+#define JAVASCRIPT_LEXER_HPP_
+
+#include <boost/utility/string_view.hpp>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace JSEngine {
+
+bool isIdentifierChar(char c);
+
+// reads the few constructs of a player script the engine needs straight from
+// its bytes
+class Lexer {
+  boost::string_view _code;
+  std::size_t _pos;
+
+ public:
+  explicit Lexer(boost::string_view code, std::size_t pos = 0);
+
+  std::size_t getPos() const;
+  void setPos(std::size_t pos);
+  bool atEnd() const;
+
+  void skipSpaces();
+  // skip spaces then c or word, don't move if they are not there
+  bool accept(char c);
+  bool accept(boost::string_view word);
+  // skip spaces then an identifier or a number, empty if there is none
+  boost::string_view identifier();
+  boost::string_view number();
+  // moves after the next c, to the end if there is none
+  bool skipPast(char c);
+  // skips spaces then a ( [ or { block and its nested blocks and strings,
+  // inside is the text between the brackets
+  bool block(boost::string_view &inside);
+};
+
+// calls op on each name:function(vars){code} member of an object body, stops
+// at the first member that is not a function
+void forEachMethod(
+    boost::string_view objectBody,
+    const std::function<void(boost::string_view name, boost::string_view vars,
+                             boost::string_view code)> &op);
+
+// definitions of a player script found in one pass over it
+class PlayerIndex {
+  boost::string_view _code;
+  // name=function( or name:function( -> offset of the (
+  std::unordered_map<std::string, std::size_t> _functions;
+  // var name={ -> offsets of var and of the {
+  std::unordered_map<std::string, std::pair<std::size_t, std::size_t> >
+      _objects;
+  // "signature",name(
+  std::string _signatureFnName;
+
+ public:
+  // code must outlive the index
+  explicit PlayerIndex(boost::string_view code);
+
+  const std::string &getSignatureFnName() const;
+  std::size_t getNbFunctions() const;
+  std::size_t getNbObjects() const;
+
+  bool findFunction(const std::string &name, boost::string_view &vars,
+                    boost::string_view &body) const;
+  // definition is var name={...}; and body what is inside the braces
+  bool findObject(const std::string &name, boost::string_view &definition,
+                  boost::string_view &body) const;
+
+ private:
+  void indexFunction(std::size_t openPos);
+  void indexObject(std::size_t openPos);
+  void indexSignatureCall(std::size_t quotePos);
+};
+
+}  // namespace JSEngine
+
+#endif /* JAVASCRIPT_LEXER_HPP_ */
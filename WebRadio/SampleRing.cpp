@@ -0,0 +1,81 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SampleRing.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Audio {
+
+namespace {
+
+std::size_t roundUpPowerOf2(std::size_t value) {
+  std::size_t power = 1;
+  while (power < value) {
+    power <<= 1;
+  }
+  return power;
+}
+
+}  // namespace
+
+SampleRing::SampleRing(std::size_t capacity)
+    : _capacity(roundUpPowerOf2(capacity)),
+      _samples(new float[_capacity]),
+      _head(0),
+      _tail(0) {}
+
+std::size_t SampleRing::write(const float *samples, std::size_t count) {
+  const std::size_t head = _head.load(std::memory_order_relaxed);
+  const std::size_t tail = _tail.load(std::memory_order_acquire);
+  count = std::min(count, _capacity - (head - tail));
+
+  // at most two copies, before and after the wrap
+  const std::size_t pos = head & (_capacity - 1);
+  const std::size_t first = std::min(count, _capacity - pos);
+  std::memcpy(&_samples[pos], samples, first * sizeof(float));
+  std::memcpy(&_samples[0], samples + first, (count - first) * sizeof(float));
+
+  _head.store(head + count, std::memory_order_release);
+  return count;
+}
+
+std::size_t SampleRing::read(float *samples, std::size_t count) {
+  const std::size_t tail = _tail.load(std::memory_order_relaxed);
+  const std::size_t head = _head.load(std::memory_order_acquire);
+  count = std::min(count, head - tail);
+
+  const std::size_t pos = tail & (_capacity - 1);
+  const std::size_t first = std::min(count, _capacity - pos);
+  std::memcpy(samples, &_samples[pos], first * sizeof(float));
+  std::memcpy(samples + first, &_samples[0], (count - first) * sizeof(float));
+
+  _tail.store(tail + count, std::memory_order_release);
+  return count;
+}
+
+std::size_t SampleRing::size() const {
+  return _head.load(std::memory_order_acquire) -
+         _tail.load(std::memory_order_acquire);
+}
+
+std::size_t SampleRing::getCapacity() const { return _capacity; }
+
+}  // namespace Audio
@@ -0,0 +1,59 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SAMPLERING_HPP
+#define SAMPLERING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace Audio {
+
+// lock-free ring of interleaved float samples between exactly one producer,
+// the decoder, and one consumer, the SDL callback. Blocks of samples are
+// moved with memcpy, neither side ever waits on the other.
+class SampleRing {
+ public:
+  // capacity in samples, rounded up to a power of 2
+  explicit SampleRing(std::size_t capacity);
+  SampleRing(const SampleRing &) = delete;
+  SampleRing(SampleRing &&) = delete;
+
+  // producer side, copies as many samples as fit and returns that count
+  std::size_t write(const float *samples, std::size_t count);
+  // consumer side, copies as many samples as are available and returns
+  // that count
+  std::size_t read(float *samples, std::size_t count);
+
+  // samples readable, exact for the consumer, a lower bound for the producer
+  std::size_t size() const;
+  std::size_t getCapacity() const;
+
+ private:
+  const std::size_t _capacity;
+  std::unique_ptr<float[]> _samples;
+  // each index is written by one side only, kept on its own cache line
+  alignas(64) std::atomic<std::size_t> _head;
+  alignas(64) std::atomic<std::size_t> _tail;
+};
+
+}  // namespace Audio
+
+#endif
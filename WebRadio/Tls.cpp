@@ -0,0 +1,197 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Tls.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+
+#include "Utils.hpp"
+
+namespace Http {
+
+namespace {
+
+int getExDataIndex() {
+  static const int index =
+      ::SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+bool isExpired(const ::SSL_SESSION *session) {
+  return ::SSL_SESSION_get_time(session) + ::SSL_SESSION_get_timeout(session) <
+         std::time(nullptr);
+}
+
+void writeBlock(std::ofstream &ofs, const std::string &block) {
+  const std::uint32_t size = block.size();
+  ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  ofs.write(block.data(), block.size());
+}
+
+// the sessions hold the resumption secrets, only the owner may read the
+// file, an existing file gets its mode restricted before it is rewritten
+bool restrictToOwner(const std::string &filePath) {
+  const int fd =
+      ::open(filePath.c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    LOG << "could not create " << filePath << " : " << std::strerror(errno);
+    return false;
+  }
+  const bool isRestricted = ::fchmod(fd, S_IRUSR | S_IWUSR) == 0;
+  if (!isRestricted) {
+    LOG << "could not restrict " << filePath << " : " << std::strerror(errno);
+  }
+  ::close(fd);
+  return isRestricted;
+}
+
+bool readBlock(std::ifstream &ifs, std::string &block) {
+  std::uint32_t size = 0;
+  // a session is a few KB, anything bigger is a corrupted file
+  if (!ifs.read(reinterpret_cast<char *>(&size), sizeof(size)) ||
+      size > 64 * 1024) {
+    return false;
+  }
+  block.resize(size);
+  return static_cast<bool>(ifs.read(&block[0], size));
+}
+
+}  // namespace
+
+TlsSessionCache::TlsSessionCache(ssl::context &ctx, std::string filePath)
+    : _mutex(),
+      _sslCtx(ctx.native_handle()),
+      _sessions(),
+      _filePath(std::move(filePath)),
+      _nbResumed(0),
+      _nbFull(0) {
+  // client side cache is ours, OpenSSL only hands us the new sessions
+  ::SSL_CTX_set_session_cache_mode(
+      _sslCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  ::SSL_CTX_sess_set_new_cb(_sslCtx, &TlsSessionCache::onNewSession);
+  ::SSL_CTX_set_ex_data(_sslCtx, getExDataIndex(), this);
+  load();
+}
+
+TlsSessionCache::~TlsSessionCache() {
+  ::SSL_CTX_set_ex_data(_sslCtx, getExDataIndex(), nullptr);
+  LOG << "TLS handshakes : " << _nbResumed << " resumed, " << _nbFull
+      << " full";
+  save();
+  for (auto &session : _sessions) {
+    ::SSL_SESSION_free(session.second);
+  }
+}
+
+TlsSessionCache *TlsSessionCache::find(::SSL *ssl) {
+  return static_cast<TlsSessionCache *>(
+      ::SSL_CTX_get_ex_data(::SSL_get_SSL_CTX(ssl), getExDataIndex()));
+}
+
+int TlsSessionCache::onNewSession(::SSL *ssl, ::SSL_SESSION *session) {
+  TlsSessionCache *cache = find(ssl);
+  const char *host = ::SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (cache == nullptr || host == nullptr) {
+    // OpenSSL keeps ownership
+    return 0;
+  }
+  cache->store(host, session);
+  return 1;
+}
+
+void TlsSessionCache::store(const std::string &host, ::SSL_SESSION *session) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  ::SSL_SESSION *&stored = _sessions[host];
+  if (stored != nullptr) {
+    ::SSL_SESSION_free(stored);
+  }
+  stored = session;
+  LOG << "TLS session stored for " << host;
+}
+
+void TlsSessionCache::prepare(::SSL *ssl, const std::string &host) {
+  // SNI, also needed to know the host of new sessions
+  ::SSL_set_tlsext_host_name(ssl, host.c_str());
+
+  TlsSessionCache *cache = find(ssl);
+  if (cache == nullptr) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(cache->_mutex);
+  auto itSession = cache->_sessions.find(host);
+  if (itSession != cache->_sessions.end() && !isExpired(itSession->second)) {
+    // takes its own reference
+    ::SSL_set_session(ssl, itSession->second);
+  }
+}
+
+void TlsSessionCache::onHandshake(::SSL *ssl) {
+  const bool isResumed = ::SSL_session_reused(ssl) == 1;
+  std::lock_guard<std::mutex> lock(_mutex);
+  ++(isResumed ? _nbResumed : _nbFull);
+}
+
+void TlsSessionCache::load() {
+  if (_filePath.empty()) {
+    return;
+  }
+  std::ifstream ifs(_filePath, std::ifstream::binary);
+  std::string host;
+  std::string der;
+  while (readBlock(ifs, host) && readBlock(ifs, der)) {
+    const unsigned char *derData =
+        reinterpret_cast<const unsigned char *>(der.data());
+    ::SSL_SESSION *session = ::d2i_SSL_SESSION(nullptr, &derData, der.size());
+    if (session == nullptr) {
+      LOG << "could not decode TLS session of " << host;
+    } else if (isExpired(session)) {
+      ::SSL_SESSION_free(session);
+    } else {
+      store(host, session);
+    }
+  }
+}
+
+void TlsSessionCache::save() const {
+  if (_filePath.empty() || !restrictToOwner(_filePath)) {
+    return;
+  }
+  std::ofstream ofs(_filePath, std::ofstream::binary | std::ofstream::trunc);
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (const auto &session : _sessions) {
+    const int size = ::i2d_SSL_SESSION(session.second, nullptr);
+    if (size <= 0 || isExpired(session.second)) {
+      continue;
+    }
+    std::string der(size, '\0');
+    unsigned char *derData = reinterpret_cast<unsigned char *>(&der[0]);
+    ::i2d_SSL_SESSION(session.second, &derData);
+    writeBlock(ofs, session.first);
+    writeBlock(ofs, der);
+  }
+}
+
+}  // namespace Http
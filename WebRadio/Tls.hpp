@@ -0,0 +1,67 @@
+/*
+ Copyright 2018 - Ivan Landry
+
+ This file is part of WebRadio.
+
+WebRadio is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+WebRadio is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TLS_HPP_
+#define TLS_HPP_
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace Http {
+namespace ssl = boost::asio::ssl;
+
+// TLS sessions (ids and tickets) stored per host, later handshakes to the
+// same host resume them and skip a round trip and the asymmetric crypto.
+// Registers itself on the context, every stream created from it uses it
+class TlsSessionCache {
+  mutable std::mutex _mutex;
+  ::SSL_CTX *_sslCtx;
+  std::map<std::string, ::SSL_SESSION *> _sessions;
+  std::string _filePath;
+  std::size_t _nbResumed;
+  std::size_t _nbFull;
+
+  static int onNewSession(::SSL *ssl, ::SSL_SESSION *session);
+  void store(const std::string &host, ::SSL_SESSION *session);
+  void load();
+
+ public:
+  // sessions are read from and saved to filePath when not empty
+  TlsSessionCache(ssl::context &ctx, std::string filePath = std::string());
+  ~TlsSessionCache();
+  TlsSessionCache(const TlsSessionCache &) = delete;
+  TlsSessionCache(TlsSessionCache &&) = delete;
+
+  // cache registered on the context of ssl, nullptr if none
+  static TlsSessionCache *find(::SSL *ssl);
+
+  // sets SNI and the last session known for host, call before handshake
+  static void prepare(::SSL *ssl, const std::string &host);
+  // records whether the handshake resumed a session
+  void onHandshake(::SSL *ssl);
+
+  void save() const;
+};
+
+}  // namespace Http
+
+#endif /* TLS_HPP_ */
@@ -19,20 +19,301 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "Utils.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <ctime>
 #include <iomanip>
 
 namespace Utils {
+Histogram::Histogram() : _buckets(), _count(0), _sum(0), _max(0) {
+  for (std::atomic<std::uint64_t>& bucket : _buckets) {
+    bucket = 0;
+  }
+}
+
+void Histogram::record(std::uint64_t value) {
+  std::size_t idx = 0;
+  while ((value >> idx) > 0 && idx < NbBuckets - 1) {
+    ++idx;
+  }
+  _buckets[idx].fetch_add(1, std::memory_order_relaxed);
+  _count.fetch_add(1, std::memory_order_relaxed);
+  _sum.fetch_add(value, std::memory_order_relaxed);
+  std::uint64_t max = _max.load(std::memory_order_relaxed);
+  while (value > max && !_max.compare_exchange_weak(max, value)) {
+  }
+}
+
+std::uint64_t Histogram::getCount() const { return _count.load(); }
+
+std::uint64_t Histogram::getMean() const {
+  const std::uint64_t count = _count.load();
+  return count == 0 ? 0 : _sum.load() / count;
+}
+
+std::uint64_t Histogram::getMax() const { return _max.load(); }
+
+std::uint64_t Histogram::getPercentile(double ratio) const {
+  const std::uint64_t target =
+      static_cast<std::uint64_t>(ratio * _count.load() + 0.5);
+  std::uint64_t count = 0;
+  for (std::size_t idx = 0; idx < NbBuckets; ++idx) {
+    count += _buckets[idx].load();
+    if (count >= target && count > 0) {
+      // bucket idx holds values below 2^idx
+      return std::min<std::uint64_t>(std::uint64_t(1) << idx, getMax());
+    }
+  }
+  return getMax();
+}
+
+std::ostream& operator<<(std::ostream& os, const Histogram& histogram) {
+  return os << "n=" << histogram.getCount() << " mean=" << histogram.getMean()
+            << " p50<=" << histogram.getPercentile(0.5)
+            << " p90<=" << histogram.getPercentile(0.9)
+            << " p99<=" << histogram.getPercentile(0.99)
+            << " max=" << histogram.getMax();
+}
+
+// single producer, the owning thread, single consumer, the flush thread
+class Logger::Ring {
+  struct Record {
+    std::uint64_t _time;
+    std::size_t _size;
+    // rest of the line of the previous record
+    bool _isContinuation;
+    std::array<char, LineSize> _text;
+  };
+
+  std::array<Record, RingSize> _records;
+  // written by the producer, read by the consumer, on separate cache lines
+  alignas(64) std::atomic<std::size_t> _head;
+  alignas(64) std::atomic<std::size_t> _tail;
+  std::atomic<bool> _isOwned;
+
+ public:
+  Ring() : _records(), _head(0), _tail(0), _isOwned(false) {}
+
+  // a long line takes consecutive records published at once, so that the
+  // consumer never sees part of it
+  bool push(std::uint64_t time, const char* text, std::size_t size) {
+    const std::size_t nbRecords =
+        std::max<std::size_t>(1, (size + LineSize - 1) / LineSize);
+    const std::size_t head = _head.load(std::memory_order_relaxed);
+    if (head + nbRecords - _tail.load(std::memory_order_acquire) > RingSize) {
+      return false;
+    }
+    for (std::size_t idx = 0; idx < nbRecords; ++idx) {
+      Record& record = _records[(head + idx) % RingSize];
+      record._time = time;
+      // LineSize by value, std::min would odr-use it
+      const std::size_t left = size - idx * LineSize;
+      record._size = left < LineSize ? left : LineSize;
+      record._isContinuation = idx > 0;
+      std::memcpy(record._text.data(), text + idx * LineSize, record._size);
+    }
+    _head.store(head + nbRecords, std::memory_order_release);
+    return true;
+  }
+
+  template <typename F>
+  void drain(F&& write) {
+    const std::size_t head = _head.load(std::memory_order_acquire);
+    std::size_t tail = _tail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail) {
+      const Record& record = _records[tail % RingSize];
+      write(record._time, record._text.data(), record._size,
+            record._isContinuation);
+    }
+    _tail.store(tail, std::memory_order_release);
+  }
+
+  bool isEmpty() const {
+    return _head.load(std::memory_order_acquire) ==
+           _tail.load(std::memory_order_acquire);
+  }
+
+  // a ring left by an exited thread is handed out again once drained
+  bool tryOwn() {
+    bool isOwned = false;
+    return isEmpty() && _isOwned.compare_exchange_strong(isOwned, true);
+  }
+
+  void disown() { _isOwned.store(false); }
+};
+
+Logger::Line::Buffer::Buffer(char* begin, std::size_t size,
+                             std::string& spill)
+    : _spill(spill) {
+  setp(begin, begin + size);
+}
+
+std::size_t Logger::Line::Buffer::size() const { return pptr() - pbase(); }
+
+int Logger::Line::Buffer::overflow(int c) {
+  // stops growing once the line is cut anyway
+  if (_spill.size() <= MaxLineSize) {
+    _spill.append(pbase(), size());
+  }
+  setp(pbase(), epptr());
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+Logger::Line::Line(boost::string_view fileName, int line)
+    : _time(Logger::now()),
+      _text(),
+      _spill(),
+      _buffer(_text.data(), _text.size(), _spill),
+      _os(&_buffer) {
+  _os << "[" << fileName << ":" << line << "]";
+}
+
+Logger::Line::~Line() {
+  Logger& logger = Logger::getInstance();
+  const char* text = _text.data();
+  std::size_t size = _buffer.size();
+  if (!_spill.empty()) {
+    _spill.append(text, size);
+    if (_spill.size() > MaxLineSize) {
+      static const boost::string_view cutMark = " [cut]";
+      _spill.resize(MaxLineSize - cutMark.size());
+      _spill.append(cutMark.data(), cutMark.size());
+      logger._cut.fetch_add(1, std::memory_order_relaxed);
+    }
+    text = _spill.data();
+    size = _spill.size();
+  }
+  if (!getRing().push(_time, text, size)) {
+    logger._dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::atomic<int> Logger::_level(static_cast<int>(LogLevel::Info));
+
+void Logger::setLevel(LogLevel level) {
+  _level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+std::uint64_t Logger::getDroppedCount() {
+  return getInstance()._dropped.load(std::memory_order_relaxed);
+}
+
+std::uint64_t Logger::getCutCount() {
+  return getInstance()._cut.load(std::memory_order_relaxed);
+}
+
 Logger::Logger()
-    : _ofs("WebRadio.log", std::ofstream::trunc | std::ofstream::out) {}
+    : _start(std::chrono::steady_clock::now()),
+      _dropped(0),
+      _cut(0),
+      _reportedDropped(0),
+      _reportedCut(0),
+      _ringsMutex(),
+      _rings(),
+      _ofs("WebRadio.log", std::ofstream::trunc | std::ofstream::out),
+      _stopMutex(),
+      _stopCondition(),
+      _isStopping(false),
+      _flushThread() {
+  // wall clock once, lines carry the time elapsed since then
+  const std::time_t now = std::time(nullptr);
+  std::tm tm;
+  ::localtime_r(&now, &tm);
+  _ofs << "[" << std::put_time(&tm, "%F %T") << "] log started";
+  _flushThread = std::thread([this]() { flushLoop(); });
+}
+
+Logger::~Logger() {
+  {
+    std::lock_guard<std::mutex> lock(_stopMutex);
+    _isStopping = true;
+  }
+  _stopCondition.notify_one();
+  _flushThread.join();
+  // reports the final dropped and cut counts
+  drain();
+  _ofs << "\n";
+}
 
-Logger& Logger::getLogger(boost::string_view fileName, int line) {
+Logger& Logger::getInstance() {
   static Logger logger;
-  const std::time_t now = std::time(nullptr);
-  const std::tm tm = *std::localtime(&now);
-  return logger << "\n"
-                << "[" << std::put_time(&tm, "%T") << "]" << "[" << fileName
-                << ":" << line << "]";
+  return logger;
+}
+
+std::uint64_t Logger::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - getInstance()._start)
+      .count();
+}
+
+Logger::Ring& Logger::getRing() {
+  // gives the ring back when the thread exits
+  struct Owner {
+    Ring& _ring;
+    Owner() : _ring(getInstance().acquireRing()) {}
+    ~Owner() { _ring.disown(); }
+  };
+  thread_local Owner owner;
+  return owner._ring;
+}
+
+Logger::Ring& Logger::acquireRing() {
+  std::lock_guard<std::mutex> lock(_ringsMutex);
+  for (const std::unique_ptr<Ring>& ring : _rings) {
+    if (ring->tryOwn()) {
+      return *ring;
+    }
+  }
+  _rings.emplace_back(new Ring);
+  _rings.back()->tryOwn();
+  return *_rings.back();
+}
+
+void Logger::flushLoop() {
+  static const std::chrono::milliseconds FlushPeriod(50);
+  std::unique_lock<std::mutex> lock(_stopMutex);
+  while (!_stopCondition.wait_for(lock, FlushPeriod,
+                                  [this]() { return _isStopping; })) {
+    drain();
+  }
+}
+
+void Logger::drain() {
+  // rings are never freed, the file is written without holding the mutex a
+  // thread takes for its first line
+  std::vector<Ring*> rings;
+  {
+    std::lock_guard<std::mutex> lock(_ringsMutex);
+    rings.reserve(_rings.size());
+    for (const std::unique_ptr<Ring>& ring : _rings) {
+      rings.push_back(ring.get());
+    }
+  }
+  // lines of different threads are not merged by time, each ring is in order
+  for (Ring* ring : rings) {
+    ring->drain([this](std::uint64_t time, const char* text, std::size_t size,
+                       bool isContinuation) {
+      if (!isContinuation) {
+        _ofs << "\n[" << std::setw(7) << time / 1000000000 << "."
+             << std::setw(6) << std::setfill('0') << time / 1000 % 1000000
+             << std::setfill(' ') << "]";
+      }
+      _ofs.write(text, size);
+    });
+  }
+  const std::uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+  const std::uint64_t cut = _cut.load(std::memory_order_relaxed);
+  if (dropped != _reportedDropped || cut != _reportedCut) {
+    _ofs << "\n" << dropped << " log lines dropped, " << cut
+         << " cut since start";
+    _reportedDropped = dropped;
+    _reportedCut = cut;
+  }
+  _ofs.flush();
 }
 
 void saveFile(const std::string& filePath, const std::string& fileContent,
@@ -20,12 +20,47 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <array>
+#include <atomic>
 #include <boost/utility/string_view.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
-
-#define LOG Utils::Logger::getLogger(Utils::fileName(__FILE__), __LINE__)
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// statements above this level are compiled out : 0 errors, 1 warnings,
+// 2 info, 3 debug
+#ifndef WEBRADIO_LOG_LEVEL
+#define WEBRADIO_LOG_LEVEL 2
+#endif
+
+// a disabled statement is an empty if branch, its arguments are not
+// evaluated and no timestamp is taken
+#define LOG_AT(level)                                                      \
+  if (!Utils::isLogCompiled(level) || !Utils::Logger::isEnabled(level)) { \
+  } else                                                                   \
+    Utils::Logger::Line(Utils::fileName(__FILE__), __LINE__)
+
+#define LOG_ERROR LOG_AT(Utils::LogLevel::Error)
+#define LOG_WARNING LOG_AT(Utils::LogLevel::Warning)
+#define LOG LOG_AT(Utils::LogLevel::Info)
+// per evaluation, per chunk traces
+#define LOG_DEBUG LOG_AT(Utils::LogLevel::Debug)
 
 namespace Utils {
+enum class LogLevel : int { Error = 0, Warning = 1, Info = 2, Debug = 3 };
+
+constexpr bool isLogCompiled(LogLevel level) {
+  return static_cast<int>(level) <= WEBRADIO_LOG_LEVEL;
+}
+
 constexpr const char* endChars(const char* chars) {
   return *chars == '\0' ? chars : endChars(++chars);
 }
@@ -47,22 +82,123 @@ void saveFile(const std::string& filePath, const std::string& fileContent,
 
 std::string readFile(const std::string& fileName);
 
-class Logger {
-  std::ofstream _ofs;
+// counts values in power of 2 buckets, can be fed from any thread
+class Histogram {
+  static const std::size_t NbBuckets = 48;
+  std::array<std::atomic<std::uint64_t>, NbBuckets> _buckets;
+  std::atomic<std::uint64_t> _count;
+  std::atomic<std::uint64_t> _sum;
+  std::atomic<std::uint64_t> _max;
 
  public:
-  Logger();
+  Histogram();
+  Histogram(const Histogram &) = delete;
+  Histogram(Histogram &&) = delete;
 
-  static Logger& getLogger(boost::string_view fileName, int line);
+  void record(std::uint64_t value);
+
+  std::uint64_t getCount() const;
+  std::uint64_t getMean() const;
+  std::uint64_t getMax() const;
+  // upper bound of the bucket holding the percentile, 0 < ratio <= 1
+  std::uint64_t getPercentile(double ratio) const;
+};
 
-  // no concurrent logging needed at the moment
-  template <typename T>
-  Logger& operator<<(const T& t) {
-    _ofs << t;
-    // for debug
-    //_ofs.flush();
-    return *this;
+// count, mean, p50, p90, p99 and max
+std::ostream &operator<<(std::ostream &, const Histogram &);
+
+// producers format into their own thread's ring buffer and never block, a
+// background thread drains the rings to WebRadio.log
+class Logger {
+ public:
+  // formatted on the stack up to this size, longer lines take several
+  // records of the ring
+  static const std::size_t LineSize = 256;
+  // longer lines are cut and marked as such
+  static const std::size_t MaxLineSize = 16 * LineSize;
+  // records a thread can have pending before the next lines are dropped
+  static const std::size_t RingSize = 512;
+
+  class Ring;
+
+  // one log line, formatted on the stack and pushed to the ring of the
+  // calling thread when destroyed. A line longer than LineSize spills to
+  // the heap
+  class Line {
+    class Buffer : public std::streambuf {
+      std::string &_spill;
+
+     public:
+      Buffer(char *begin, std::size_t size, std::string &spill);
+      // bytes formatted since the last spill
+      std::size_t size() const;
+
+     protected:
+      int overflow(int c) override;
+    };
+
+    std::uint64_t _time;
+    std::array<char, LineSize> _text;
+    std::string _spill;
+    Buffer _buffer;
+    std::ostream _os;
+
+   public:
+    Line(boost::string_view fileName, int line);
+    Line(const Line &) = delete;
+    Line(Line &&) = delete;
+    ~Line();
+
+    template <typename T>
+    Line &operator<<(const T &t) {
+      _os << t;
+      return *this;
+    }
+  };
+
+  Logger(const Logger &) = delete;
+  Logger(Logger &&) = delete;
+  ~Logger();
+
+  // runtime filter among the compiled levels, Info by default
+  static void setLevel(LogLevel level);
+  static bool isEnabled(LogLevel level) {
+    return static_cast<int>(level) <= _level.load(std::memory_order_relaxed);
   }
+
+  // lines lost because a ring was full
+  static std::uint64_t getDroppedCount();
+  // lines cut at MaxLineSize
+  static std::uint64_t getCutCount();
+
+ private:
+  Logger();
+
+  static Logger &getInstance();
+  // nanoseconds since the logger started, steady clock
+  static std::uint64_t now();
+  static Ring &getRing();
+
+  Ring &acquireRing();
+  void flushLoop();
+  void drain();
+
+  static std::atomic<int> _level;
+
+  const std::chrono::steady_clock::time_point _start;
+  std::atomic<std::uint64_t> _dropped;
+  std::atomic<std::uint64_t> _cut;
+  std::uint64_t _reportedDropped;
+  std::uint64_t _reportedCut;
+  // taken when a thread logs for the first time and by the flush thread to
+  // copy the list, never while writing the file
+  std::mutex _ringsMutex;
+  std::vector<std::unique_ptr<Ring>> _rings;
+  std::ofstream _ofs;
+  std::mutex _stopMutex;
+  std::condition_variable _stopCondition;
+  bool _isStopping;
+  std::thread _flushThread;
 };
 
 }  // namespace Utils
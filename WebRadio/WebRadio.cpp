@@ -17,6 +17,7 @@ You should have received a copy of the GNU Affero General Public License
 along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <boost/program_options.hpp>
 #include <cstdlib>
 #include <fstream>
@@ -26,10 +27,14 @@ along with WebRadio.  If not, see <https://www.gnu.org/licenses/>.
 #include <string>
 #include <thread>
 #include <typeinfo>
+#include <vector>
 
 #include "Audio.hpp"
+#include "Download.hpp"
 #include "HtmlParser.hpp"
 #include "Http.hpp"
+#include "JavascriptEngine.hpp"
+#include "Tls.hpp"
 #include "Utils.hpp"
 
 int main(int argc, char* argv[]) {
@@ -37,15 +42,55 @@ int main(int argc, char* argv[]) {
 
   bool isDownload = false;
   bool isPlay = false;
-  bool isRepeat = false;
+  bool isBenchDownload = false;
+  Audio::PlayOptions playOptions;
+  Http::SegmentOptions segmentOptions;
+  std::size_t segmentSizeKb = segmentOptions._segmentSize / 1024;
+  // no multi-core gain measured yet, more threads are opt-in
+  std::size_t nbIoThreads = 1;
 
   std::string publicUrlStr;
+  std::string benchJsPath;
+  std::size_t nbBenchRuns = 1000;
+  std::size_t decodeAheadMs = playOptions._decodeAhead.count();
+  std::string benchAudioPath;
+  const int logLevel = static_cast<int>(Utils::LogLevel::Info);
   try {
     po::options_description desc("Arguments");
     desc.add_options()("help", "list command arguments")(
         "url", po::value<std::string>(&publicUrlStr)->required(),
         "Youtube video URL")("download,D", "Download the video")(
-        "play,P", "Play audio")("repeat,R", "Repeat mode");
+        "play,P", "Play audio")("repeat,R", "Repeat mode")(
+        "decode-ahead",
+        po::value<std::size_t>(&decodeAheadMs)->default_value(decodeAheadMs),
+        "Milliseconds of audio decoded ahead of playback")(
+        "decode-threads",
+        po::value<int>(&playOptions._nbDecodeThreads)
+            ->default_value(playOptions._nbDecodeThreads),
+        "Codec threads, 0 for one per core, only some codecs use them")(
+        "connections,C",
+        po::value<std::size_t>(&segmentOptions._nbConnections)
+            ->default_value(segmentOptions._nbConnections),
+        "Parallel connections for the video download")(
+        "io-threads,T",
+        po::value<std::size_t>(&nbIoThreads)->default_value(nbIoThreads),
+        "Threads running TLS and HTTP parsing of all connections, up to "
+        "the number of cores")(
+        "segment-size",
+        po::value<std::size_t>(&segmentSizeKb)->default_value(segmentSizeKb),
+        "Size in KB of each video segment")(
+        "bench-decipher", po::value<std::string>(&benchJsPath),
+        "Time signature deciphering on a saved player script (js_code.txt)")(
+        "bench-runs", po::value<std::size_t>(&nbBenchRuns)
+                          ->default_value(nbBenchRuns),
+        "Signatures deciphered by --bench-decipher")(
+        "bench-download",
+        "Time the video download over 1 connection and 1 io thread, then "
+        "over --connections, then over --io-threads as well")(
+        "bench-decode", po::value<std::string>(&benchAudioPath),
+        "Time decoding of a saved video (videoData) without playing it")(
+        "log-level,L", po::value<int>()->default_value(logLevel),
+        "0 errors, 1 warnings, 2 info, 3 debug (if compiled in)");
 
     po::positional_options_description p;
     po::variables_map argsMap;
@@ -55,27 +100,87 @@ int main(int argc, char* argv[]) {
 
     isDownload = argsMap.count("download");
     isPlay = argsMap.count("play");
-    isRepeat = argsMap.count("repeat");
+    isBenchDownload = argsMap.count("bench-download");
+    playOptions._isRepeat = argsMap.count("repeat");
+    // variables are only filled by notify, which needs an url
+    Utils::Logger::setLevel(static_cast<Utils::LogLevel>(
+        std::min(std::max(argsMap["log-level"].as<int>(), 0), 3)));
 
-    if (argsMap.count("help") || (!isDownload && !isPlay)) {
+    if (argsMap.count("bench-decipher")) {
+      benchJsPath = argsMap["bench-decipher"].as<std::string>();
+      nbBenchRuns = argsMap["bench-runs"].as<std::size_t>();
+      const JSEngine::DecipherProgram& program =
+          JSEngine::extractProgram(Utils::readFile(benchJsPath));
+      if (program.empty()) {
+        std::cerr << "no signature function in " << benchJsPath << std::endl;
+        return EXIT_FAILURE;
+      }
+      // any signature works, the transforms don't depend on its content
+      JSEngine::benchmarkDecipher(
+          program,
+          "4F54F57EA340B453B68F8A026846D0A329180B3DCCE."
+          "D9F57E82A09AC96B32A198B384748090D547223832",
+          nbBenchRuns, std::cout);
+      return EXIT_SUCCESS;
+    }
+
+    if (argsMap.count("bench-decode")) {
+      benchAudioPath = argsMap["bench-decode"].as<std::string>();
+      const std::string fileContent = Utils::readFile(benchAudioPath);
+      Http::StreamBuffer audioData;
+      audioData.onHeader(fileContent.size());
+      audioData.onData(fileContent.data(), fileContent.size());
+      audioData.onEnd(nullptr);
+      Audio::benchmarkDecode(audioData, argsMap["decode-threads"].as<int>(),
+                             std::cout);
+      return EXIT_SUCCESS;
+    }
+
+    if (argsMap.count("help") ||
+        (!isDownload && !isPlay && !isBenchDownload)) {
       std::cout << "Usage: options_description [options] " << std::endl;
       std::cout << desc;
       return EXIT_SUCCESS;
     }
 
     po::notify(argsMap);
+    segmentOptions._segmentSize = segmentSizeKb * 1024;
   } catch (const std::exception ex) {
     std::cerr << ex.what() << std::endl;
     return EXIT_FAILURE;
   }
 
-  boost::asio::io_context ioService(1);  // run in a single thread
+  nbIoThreads = std::max<std::size_t>(1, nbIoThreads);
+  LOG << "running io on " << nbIoThreads << " threads";
+  boost::asio::io_context ioService(static_cast<int>(nbIoThreads));
   boost::asio::ssl::context ctx(boost::asio::ssl::context::sslv23_client);
   ctx.set_default_verify_paths();
+  // resumes sessions of previous runs
+  Http::TlsSessionCache tlsSessionCache(ctx, "tls_sessions.cache");
+  Http::ResolverCache& resolverCache = Http::getResolverCache();
+  resolverCache.load("dns.cache");
+  JSEngine::ProgramCache& programCache = JSEngine::getProgramCache();
+  programCache.load("decipher.cache");
+
+  // keep-alive connections shared by all clients
+  Http::ConnectionPool connectionPool;
+
+  // player scripts are versioned by their path
+  Http::ResponseCache responseCache("http.cache");
+  responseCache.setImmutable("s.ytimg.com");
 
-  Http::Client clientHtml(ioService, ctx);
-  Http::Client clientJs(ioService, ctx);
-  Http::Client clientVideo(ioService, ctx);
+  Http::Client clientHtml(ioService, ctx, connectionPool);
+  Http::Client clientJs(ioService, ctx, connectionPool);
+  // lives as long as the io threads, a request may still be shutting down
+  Http::Client clientVideo(ioService, ctx, connectionPool);
+  // only the versioned player script : the watch page sets cookies and
+  // carries expiring stream urls
+  clientJs.setResponseCache(responseCache);
+  // a stalled page or player script fails within this, retries included
+  Http::Timeouts pageTimeouts;
+  pageTimeouts._total = std::chrono::seconds(10);
+  clientHtml.setTimeouts(pageTimeouts);
+  clientJs.setTimeouts(pageTimeouts);
 
   Http::Url youtubeUrl(publicUrlStr);
 
@@ -84,57 +189,101 @@ int main(int argc, char* argv[]) {
   // "443",
   //        "/watch?has_verified=1&bpctr=9999999999&hl=en&disable_polymer=true&gl=US&v=f68VJQc7qys");
 
-  std::future<std::string> htmlFuture =
+  std::future<Http::Response> htmlFuture =
       clientHtml.get(youtubeUrl._host, "443", youtubeUrl._target);
 
-  std::thread ioThread([&ioService]() { ioService.run(); });
+  // keeps the io threads alive between requests
+  auto ioWork = boost::asio::make_work_guard(ioService);
+  std::vector<std::thread> ioThreads;
+  for (std::size_t i = 0; i < nbIoThreads; ++i) {
+    ioThreads.emplace_back([&ioService]() { ioService.run(); });
+  }
 
   std::function<void(void)> playAudioFct;
-  std::function<void(void)> saveFileFct;
 
-  const std::string& html = htmlFuture.get();
+  const Http::Response htmlResponse = htmlFuture.get();
+  const std::string& html = htmlResponse._body;
 
   const std::string& cookies = clientHtml.getResponseCookies();
   clientJs.setRequestCookies(cookies);
 
   Http::Url videoUrl = HtmlParser::extractVideoUrl(clientJs, html);
-  std::string videoData;
-
-  if (!videoUrl.empty()) {
-    std::future<std::string> videoFuture =
-        clientVideo.get(videoUrl._host, "443", videoUrl._target);
-
-    videoData = videoFuture.get();
+  // filled by the io thread while the audio thread decodes it
+  Http::StreamBuffer videoData;
+  // written chunk by chunk by the io thread
+  boost::optional<Http::FileSink> videoFile;
+  Http::TeeSink videoSinks;
+  std::future<std::size_t> videoFuture;
 
+  if (!videoUrl.empty() && isBenchDownload) {
+    Http::benchmarkDownload(ctx, videoUrl._host, "443", videoUrl._target,
+                            segmentOptions, nbIoThreads, std::cout);
+  } else if (!videoUrl.empty()) {
     if (isPlay) {
-      playAudioFct = [&videoData, isRepeat]() {
-        Audio::playAudio(videoData, isRepeat);
+      videoSinks.add(videoData);
+      playOptions._decodeAhead = std::chrono::milliseconds(decodeAheadMs);
+      playAudioFct = [&videoData, playOptions]() {
+        Audio::playAudio(videoData, playOptions);
       };
     }
 
+    std::uint64_t resumeOffset = 0;
     if (isDownload) {
-      saveFileFct = [&videoData, &publicUrlStr]() {
-        Utils::saveFile(
-            "videoData" /*publicUrlStr*/, videoData,
-            std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
-      };
+      // the player needs the whole body, resume a previous run only when
+      // saving and only if the video did not change since
+      std::string videoVersion;
+      if (!isPlay) {
+        try {
+          clientVideo.head(videoUrl._host, "443", videoUrl._target).get();
+          const auto& header = clientVideo.getResponseHeader();
+          if (header.result() == boost::beast::http::status::ok) {
+            videoVersion = Http::getResourceVersion(header);
+          }
+        } catch (const std::exception& ex) {
+          LOG << "video head request failed : " << ex.what();
+        }
+      }
+      videoFile.emplace("videoData" /*publicUrlStr*/, !isPlay, videoVersion);
+      videoSinks.add(*videoFile);
+      resumeOffset = videoFile->getResumeOffset();
     }
+
+    videoFuture = std::async(
+        std::launch::async,
+        [&ioService, &ctx, &connectionPool, &segmentOptions, &videoUrl,
+         &videoSinks, resumeOffset]() {
+          Http::SegmentedDownload download(ioService, ctx, connectionPool,
+                                           segmentOptions);
+          return download.run(videoUrl._host, "443", videoUrl._target,
+                              videoSinks, resumeOffset);
+        });
   }
 
-  if (playAudioFct && saveFileFct) {
-    std::thread audioThread(playAudioFct);
-    std::thread saveThread(saveFileFct);
-    audioThread.join();
-    saveThread.join();
-  } else if (saveFileFct) {
-    std::thread saveThread(saveFileFct);
-    saveThread.join();
-  } else if (playAudioFct) {
+  if (playAudioFct) {
     std::thread audioThread(playAudioFct);
     audioThread.join();
   }
 
-  ioThread.join();
+  if (videoFuture.valid()) {
+    try {
+      // outside of LOG, whose arguments are skipped when it is disabled
+      const std::size_t nbBytes = videoFuture.get();
+      LOG << "video downloaded : " << nbBytes << " bytes";
+    } catch (const std::exception& ex) {
+      LOG << "video download failed : " << ex.what();
+      std::cerr << "video download failed : " << ex.what() << std::endl;
+    }
+  }
+
+  ioWork.reset();
+  for (std::thread& ioThread : ioThreads) {
+    ioThread.join();
+  }
+
+  LOG << Http::getLatencyHistograms();
+  resolverCache.logStats();
+  resolverCache.save("dns.cache");
+  programCache.save("decipher.cache");
 
   return EXIT_SUCCESS;
 }